@@ -0,0 +1,222 @@
+/*
+ * sdlog_stress.c: Host stress test for the ringbuf -> sdlog -> FatFs path.
+ *
+ * A producer thread stands in for the sampling ISR: every millisecond tick it
+ * rb_put()s a burst of sequenced records and never retries a failed put. The
+ * main thread stands in for the main loop, calling sdlog_drain() into a file
+ * on a card image (sdcard/diskio_image.c) and stalling now and then the way a
+ * card does during an internal erase. When the producer is done the log is
+ * flushed, read back and checked:
+ *
+ *   - every record in the file is whole, its bytes in order, and the
+ *     sequence numbers strictly increase;
+ *   - records in the file plus the ring's drop count equal records produced;
+ *   - with a ring sized by SDLOG_RING_BYTES() for the stall, nothing is lost.
+ *
+ * Usage: sdlog_stress IMAGE [rate_hz [stall_ms [ring_bytes [seconds]]]]
+ *
+ * IMAGE is created (64MB) and formatted. ring_bytes defaults to
+ * SDLOG_RING_BYTES(rate_hz, REC_BYTES, stall_ms) rounded up to a power of
+ * two; give a smaller ring to exercise the drop accounting instead. Exits
+ * non-zero when a check fails. Not built for the MSP430.
+ */
+#ifndef __MSP430__
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "../sdcard/diskio.h"
+#include "../sdcard/ff.h"
+#include "../sdlog/ringbuf.h"
+#include "../sdlog/sdlog.h"
+
+#define REC_BYTES     24          /* 4 byte sequence number, 20 pattern bytes */
+#define IMAGE_MB      64
+#define LOG_NAME      "STRESS.LOG"
+#define STALL_EVERY   200         /* Drain passes between simulated card stalls */
+
+#define CHECK(c, ...) \
+  do { if (!(c)) { printf("FAIL: " __VA_ARGS__); putchar('\n'); exit(1); } } while (0)
+
+static FATFS fs;
+static FIL fil;
+static struct ringbuf rb;
+static uint8_t ring_mem[0x8000];
+
+static uint32_t rate_hz = 20000;
+static uint32_t stall_ms = 20;
+static uint32_t seconds = 2;
+static uint32_t produced;                 // Records offered to rb_put()
+static volatile int producer_done;
+
+
+// Record @seq: the sequence number little endian, then bytes that depend on
+// both the sequence number and their position, so a torn, shifted or
+// reordered record cannot pass for a good one.
+static void make_record(uint8_t *r, uint32_t seq)
+{
+  r[0] = (uint8_t)seq;
+  r[1] = (uint8_t)(seq >> 8);
+  r[2] = (uint8_t)(seq >> 16);
+  r[3] = (uint8_t)(seq >> 24);
+  for (int i = 4; i < REC_BYTES; i++)
+    r[i] = (uint8_t)(seq * 31 + i * 7);
+}
+
+
+static void sleep_us(long us)
+{
+  struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+  nanosleep(&ts, NULL);
+}
+
+
+static void tick_add(struct timespec *t, long ns)
+{
+  t->tv_nsec += ns;
+  if (t->tv_nsec >= 1000000000L) {
+    t->tv_nsec -= 1000000000L;
+    t->tv_sec++;
+  }
+}
+
+
+// The "ISR": a burst of records per 1ms tick at absolute deadlines, so the
+// rate holds however late the thread gets scheduled.
+static void *producer(void *arg)
+{
+  uint8_t rec[REC_BYTES];
+  uint32_t per_tick = rate_hz / 1000, total = rate_hz * seconds;
+  struct timespec next;
+
+  (void)arg;
+  if (!per_tick)
+    per_tick = 1;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (produced < total) {
+    for (uint32_t i = 0; i < per_tick && produced < total; i++) {
+      make_record(rec, produced);
+      rb_put(&rb, rec, REC_BYTES);              // Lost records show up in rb.drops
+      produced++;
+    }
+    tick_add(&next, 1000000L);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  RB_STORE_REL(producer_done, 1);
+  return NULL;
+}
+
+
+static uint32_t pow2_at_least(uint32_t n)
+{
+  uint32_t p = 512;
+
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+
+int main(int argc, char **argv)
+{
+  uint32_t ring_bytes, drains = 0, got = 0, prev = 0;
+  uint8_t want[REC_BYTES], rec[REC_BYTES];
+  struct sdlog lg;
+  struct sdlog_stats st;
+  pthread_t tid;
+  FRESULT res;
+  UINT br;
+  FILE *img;
+
+  if (argc < 2) {
+    printf("usage: %s IMAGE [rate_hz [stall_ms [ring_bytes [seconds]]]]\n", argv[0]);
+    return 2;
+  }
+  if (argc > 2) rate_hz = strtoul(argv[2], NULL, 0);
+  if (argc > 3) stall_ms = strtoul(argv[3], NULL, 0);
+  ring_bytes = pow2_at_least(SDLOG_RING_BYTES(rate_hz, REC_BYTES, stall_ms));
+  if (argc > 4) ring_bytes = strtoul(argv[4], NULL, 0);
+  if (argc > 5) seconds = strtoul(argv[5], NULL, 0);
+  CHECK(ring_bytes <= sizeof ring_mem && rb_init(&rb, ring_mem, (uint16_t)ring_bytes),
+        "ring of %lu bytes: a power of two from 512 to 32768", (unsigned long)ring_bytes);
+  CHECK((uint64_t)rate_hz * seconds * REC_BYTES < (IMAGE_MB - 4) * 1024UL * 1024,
+        "log does not fit on a %dMB image", IMAGE_MB);
+
+  // Fresh image, formatted as the card would be
+  img = fopen(argv[1], "wb");
+  CHECK(img && fseek(img, IMAGE_MB * 1024L * 1024 - 1, SEEK_SET) == 0 && fputc(0, img) == 0
+        && fclose(img) == 0, "cannot create %s", argv[1]);
+  CHECK(disk_image_open(argv[1], 1), "cannot open %s", argv[1]);
+  f_mount(&fs, "", 0);
+  CHECK((res = f_mkfs("", 0, 0)) == FR_OK, "f_mkfs: %d", res);
+  CHECK((res = f_mount(&fs, "", 1)) == FR_OK, "f_mount: %d", res);
+  CHECK((res = f_open(&fil, LOG_NAME, FA_CREATE_ALWAYS | FA_WRITE)) == FR_OK, "f_open: %d", res);
+  CHECK((res = sdlog_init(&lg, &rb, &fil, 16)) == FR_OK, "sdlog_init: %d", res);
+
+  printf("%lu records/s x %d bytes for %lus, %lums stalls, %lu byte ring\n",
+         (unsigned long)rate_hz, REC_BYTES, (unsigned long)seconds,
+         (unsigned long)stall_ms, (unsigned long)ring_bytes);
+
+  CHECK(pthread_create(&tid, NULL, producer, NULL) == 0, "pthread_create");
+  while (!RB_LOAD_ACQ(producer_done)) {
+    CHECK((res = sdlog_drain(&lg)) == FR_OK, "sdlog_drain: %d", res);
+    if (++drains % STALL_EVERY == 0)
+      sleep_us(stall_ms * 1000);                // Card busy
+    else
+      sleep_us(200);                            // Rest of the main loop
+  }
+  pthread_join(tid, NULL);
+  CHECK((res = sdlog_flush(&lg)) == FR_OK, "sdlog_flush: %d", res);
+  sdlog_get_stats(&lg, &st);
+  CHECK((res = f_close(&fil)) == FR_OK, "f_close: %d", res);
+
+  // Read back from a fresh mount, so nothing comes out of a cached window
+  f_mount(NULL, "", 0);
+  CHECK((res = f_mount(&fs, "", 1)) == FR_OK, "remount: %d", res);
+  CHECK((res = f_open(&fil, LOG_NAME, FA_READ)) == FR_OK, "reopen: %d", res);
+  CHECK(f_size(&fil) % REC_BYTES == 0, "file size %lu is not whole records",
+        (unsigned long)f_size(&fil));
+  while ((res = f_read(&fil, rec, REC_BYTES, &br)) == FR_OK && br == REC_BYTES) {
+    uint32_t seq = rec[0] | (uint32_t)rec[1] << 8 | (uint32_t)rec[2] << 16 | (uint32_t)rec[3] << 24;
+
+    CHECK(seq < produced && (got == 0 || seq > prev),
+          "record %lu: sequence %lu after %lu", (unsigned long)got,
+          (unsigned long)seq, (unsigned long)prev);
+    make_record(want, seq);
+    CHECK(memcmp(rec, want, REC_BYTES) == 0, "record %lu (sequence %lu): bytes out of order",
+          (unsigned long)got, (unsigned long)seq);
+    prev = seq;
+    got++;
+  }
+  CHECK(res == FR_OK, "f_read: %d", res);
+  f_close(&fil);
+  f_mount(NULL, "", 0);
+  disk_image_close();
+
+  printf("produced %lu logged %lu dropped %u (%u bytes), high water %u (%u%%), "
+         "%lu sectors, largest drain %u\n",
+         (unsigned long)produced, (unsigned long)got, st.drops, st.drop_bytes,
+         st.high_water, st.high_water_pct, (unsigned long)st.sectors, st.max_batch);
+
+  if (st.drops == 0xFFFF)                         // Counter saturated
+    CHECK(got + st.drops <= produced, "logged %lu + dropped 65535+ > produced %lu",
+          (unsigned long)got, (unsigned long)produced);
+  else
+    CHECK(got + st.drops == produced, "logged %lu + dropped %u != produced %lu",
+          (unsigned long)got, st.drops, (unsigned long)produced);
+  CHECK(st.drop_bytes == 0xFFFF || st.drop_bytes == (uint16_t)(st.drops * REC_BYTES),
+        "%u drops but %u drop bytes", st.drops, st.drop_bytes);
+  if (argc <= 4)
+    CHECK(st.drops == 0, "%u records dropped with a ring sized for %lums stalls",
+          st.drops, (unsigned long)stall_ms);
+
+  printf("PASS\n");
+  return 0;
+}
+
+#endif /* __MSP430__ */
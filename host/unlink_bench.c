@@ -0,0 +1,133 @@
+/*
+ * unlink_bench.c: Host benchmark for freeing cluster chains.
+ *
+ * Formats a 128MB card image with 4KB clusters, then writes two logs
+ * interleaved the way a logger with two open files lays them out: A.LOG
+ * (16MB) and B.LOG (24MB), with B taking two clusters for every one of A's
+ * until it runs ahead. It then times f_unlink() of A.LOG and f_truncate() of
+ * B.LOG to zero length, plus the unmount that flushes what they leave
+ * behind, in disk_write() commands and sectors (DiskStats). Last it checks
+ * that the FAT copies on the image are byte-identical; "make host" builds it
+ * with -DN_FATS=2 so f_mkfs() lays down a mirror FAT, as card formatters do.
+ *
+ * Usage: unlink_bench IMAGE
+ *
+ * IMAGE is created and overwritten. Rebuild with _FAT_SCAN_SECTS or
+ * _FS_JOURNAL changed in ffconf.h to compare the delete paths. Exits
+ * non-zero when a step fails or the FAT copies differ. Not built for the
+ * MSP430.
+ */
+#ifndef __MSP430__
+
+#include <stdio.h>
+#include <string.h>
+#include "../sdcard/diskio.h"
+#include "../sdcard/ff.h"
+
+#define IMAGE_MB      128
+#define CLUSTER       4096
+#define A_CLUSTERS    (16UL * 1024 * 1024 / CLUSTER)
+#define B_CLUSTERS    (24UL * 1024 * 1024 / CLUSTER)
+
+#define CHECK(c, ...) \
+  do { if (!(c)) { printf("FAIL: " __VA_ARGS__); putchar('\n'); return 1; } } while (0)
+
+static FATFS fs;
+static FIL fa, fb;
+static BYTE buf[CLUSTER];
+static BYTE sa[512], sb[512];
+
+struct counts {
+  DWORD writes, sects;
+};
+
+
+static void take(struct counts *m)
+{
+  m->writes = DiskStats.writes;
+  m->sects = DiskStats.wr_sects;
+}
+
+
+static void report(const char *what, const struct counts *from, const struct counts *to)
+{
+  printf("  %-10s %5lu write commands %6lu sectors\n", what,
+         (unsigned long)(to->writes - from->writes), (unsigned long)(to->sects - from->sects));
+}
+
+
+int main(int argc, char **argv)
+{
+  struct counts m0, m1, m2, m3;
+  DWORD fatbase, fsize, s;
+  BYTE fs_type, n_fats;
+  FRESULT res;
+  UINT bw;
+  FILE *img;
+
+  if (argc < 2) {
+    printf("usage: %s IMAGE\n", argv[0]);
+    return 2;
+  }
+
+  img = fopen(argv[1], "wb");
+  CHECK(img && fseek(img, IMAGE_MB * 1024L * 1024 - 1, SEEK_SET) == 0 && fputc(0, img) == 0
+        && fclose(img) == 0, "cannot create %s", argv[1]);
+  CHECK(disk_image_open(argv[1], 1), "cannot open %s", argv[1]);
+  f_mount(&fs, "", 0);
+  CHECK((res = f_mkfs("", 0, CLUSTER)) == FR_OK, "f_mkfs: %d", res);
+  CHECK((res = f_mount(&fs, "", 1)) == FR_OK, "f_mount: %d", res);
+
+  // Interleaved logs: B grows two clusters per cluster of A until A is full
+  CHECK((res = f_open(&fa, "A.LOG", FA_CREATE_ALWAYS | FA_WRITE)) == FR_OK, "f_open A: %d", res);
+  CHECK((res = f_open(&fb, "B.LOG", FA_CREATE_ALWAYS | FA_WRITE)) == FR_OK, "f_open B: %d", res);
+  for (DWORD i = 0; i < A_CLUSTERS || i * 2 < B_CLUSTERS; i++) {
+    if (i < A_CLUSTERS)
+      CHECK(f_write(&fa, buf, CLUSTER, &bw) == FR_OK && bw == CLUSTER, "write A");
+    for (int k = 0; k < 2 && f_size(&fb) < B_CLUSTERS * CLUSTER; k++)
+      CHECK(f_write(&fb, buf, CLUSTER, &bw) == FR_OK && bw == CLUSTER, "write B");
+  }
+  CHECK(f_close(&fa) == FR_OK && f_close(&fb) == FR_OK, "f_close");
+
+  fs_type = fs.fs_type;
+  n_fats = fs.n_fats;
+  fatbase = fs.fatbase;
+  fsize = fs.fsize;
+  printf("FAT%d, %lu clusters of %d bytes, A.LOG %luMB, B.LOG %luMB\n",
+         fs_type == FS_FAT32 ? 32 : fs_type == FS_FAT16 ? 16 : 12,
+         (unsigned long)(fs.n_fatent - 2), CLUSTER,
+         (unsigned long)(A_CLUSTERS * CLUSTER >> 20), (unsigned long)(B_CLUSTERS * CLUSTER >> 20));
+
+  take(&m0);
+  CHECK((res = f_unlink("A.LOG")) == FR_OK, "f_unlink: %d", res);
+  take(&m1);
+  CHECK((res = f_open(&fb, "B.LOG", FA_WRITE)) == FR_OK, "f_open B: %d", res);
+  CHECK((res = f_truncate(&fb)) == FR_OK, "f_truncate: %d", res);
+  CHECK((res = f_close(&fb)) == FR_OK, "f_close B: %d", res);
+  take(&m2);
+  f_mount(NULL, "", 0);
+  take(&m3);
+
+  report("unlink", &m0, &m1);
+  report("truncate", &m1, &m2);
+  report("unmount", &m2, &m3);
+  report("total", &m0, &m3);
+
+  // Every FAT copy must match the first, sector for sector
+  for (BYTE n = 1; n < n_fats; n++) {
+    for (s = 0; s < fsize; s++) {
+      CHECK(disk_read(0, sa, fatbase + s, 1) == RES_OK
+            && disk_read(0, sb, fatbase + n * fsize + s, 1) == RES_OK, "disk_read");
+      CHECK(memcmp(sa, sb, sizeof sa) == 0, "FAT copy %d differs at FAT sector %lu",
+            n + 1, (unsigned long)s);
+    }
+  }
+  if (n_fats > 1)
+    printf("%d FAT copies identical\n", n_fats);
+  else
+    printf("one FAT, no mirror to compare (build with -DN_FATS=2)\n");
+  disk_image_close();
+  return 0;
+}
+
+#endif /* __MSP430__ */
@@ -6,6 +6,8 @@
 #define _AUR_DEV_H
 
 #include <stdint.h>
+#include "sdcard/ff.h"
+#include "sdcard/diskio.h"
 
 /**
  * dev_init_led(): Sets up MSP430 launchpad LED pins for I/O
@@ -48,4 +50,221 @@ void dev_end(void);
  */
 void dev_clear_memory(uint16_t *start, uint16_t *end);
 
+/**
+ * dev_cycles_start(): Starts the Timer_A0 cycle counter from zero
+ *
+ * The counter runs from SMCLK, so it reads CPU cycles only when SMCLK is
+ * undivided from MCLK (DIVS__1). Overflows are counted by the TA0 overflow
+ * interrupt, which needs GIE set for measurements longer than 65535 cycles.
+ */
+void dev_cycles_start(void);
+
+/**
+ * dev_cycles_stop(): Stops the Timer_A0 cycle counter
+ *
+ * Returns the number of SMCLK cycles since dev_cycles_start().
+ */
+uint32_t dev_cycles_stop(void);
+
+/* Sizes timed by dev_bench_memops(): an SFN compare up to a full sector */
+#define DEV_BENCH_MEMOPS_SIZES  6
+
+struct dev_memops_result {
+  uint16_t size;        /* bytes per operation */
+  uint16_t cpy_byte;    /* cycles: plain byte loop (the old FatFs mem_cpy) */
+  uint16_t cpy_word;    /* cycles: sd_mem_cpy_word() */
+  uint16_t cpy_dma;     /* cycles: sd_mem_cpy_dma() */
+  uint16_t set_word;    /* cycles: sd_mem_set_word() */
+  uint16_t set_dma;     /* cycles: sd_mem_set_dma() */
+  uint16_t cmp_word;    /* cycles: sd_mem_cmp() on equal blocks */
+};
+
+/**
+ * dev_bench_memops(): Times the sd card stack memory operations
+ * @res:  Table of DEV_BENCH_MEMOPS_SIZES results (11, 32, 64, 128, 256, 512)
+ *
+ * Used to pick SD_MEMOPS_DMA_MIN for a given clock and FRAM wait state setup.
+ */
+void dev_bench_memops(struct dev_memops_result *res);
+
+/* Sample streams timed by dev_bench_compress() */
+#define DEV_BENCH_COMPRESS_STREAMS  4
+
+struct dev_compress_result {
+  uint32_t raw_bytes;       /* bytes of 16 bit samples fed to the encoder */
+  uint32_t out_bytes;       /* bytes of dvz blocks produced, partial block included */
+  uint32_t cycles;          /* SMCLK cycles spent in dvz_put() */
+  uint16_t ratio_x100;      /* raw_bytes / out_bytes, times 100 */
+  uint32_t bytes_per_sec;   /* raw bytes encoded per second at @smclk_hz */
+};
+
+/**
+ * dev_bench_compress(): Measures the dvz compressor on representative streams
+ * @res:       Table of DEV_BENCH_COMPRESS_STREAMS results: a slow drift
+ *             (temperature), a triangle wave (vibration), a noisy 3-axis
+ *             accelerometer and full-scale noise (worst case)
+ * @smclk_hz:  SMCLK frequency, used to turn cycles into bytes per second
+ *
+ * All streams are three channels. Blocks are counted but not written, so the
+ * figures are the encoder cost alone.
+ */
+void dev_bench_compress(struct dev_compress_result *res, uint32_t smclk_hz);
+
+struct dev_sync_check {
+  uint16_t cycles;          /* append + f_sync cycles judged (the first is warm-up) */
+  uint16_t alloc_cycles;    /* cycles that allocated a cluster */
+  uint16_t reread_cycles;   /* cycles that read the card without allocating, 0 expected */
+  uint32_t reads;           /* disk_read calls over all cycles */
+};
+
+/**
+ * dev_check_sync_reads(): Checks that steady-state append + f_sync does not re-read
+ * @fp:      File open for writing at a sector boundary, on a FAT32 volume
+ * @cycles:  Number of one-sector append + f_sync cycles to run
+ * @res:     Filled with the DiskStats counts
+ *
+ * A cycle that stays inside the current cluster finds the directory sector
+ * still in fs->win and should not read the card at all. Before sync_fs() got
+ * its own FSINFO buffer, every cycle after a cluster allocation re-read it.
+ * Returns 0 when no such re-read was seen.
+ */
+int dev_check_sync_reads(FIL *fp, uint16_t cycles, struct dev_sync_check *res);
+
+struct dev_getfree_result {
+  DWORD free_clust;         /* free clusters counted */
+  uint32_t cycles;          /* SMCLK cycles for the full FAT scan */
+  uint32_t reads;           /* disk_read calls during the scan */
+  uint32_t rd_sects;        /* sectors read during the scan */
+};
+
+/**
+ * dev_bench_getfree(): Times a full f_getfree() scan of the FAT
+ * @path:  Logical drive, "" for the default
+ * @res:   Filled with the count, cycles and DiskStats deltas
+ *
+ * The cached free count is dropped first so f_getfree() walks the whole FAT.
+ * Build with _FAT_SCAN_SECTS 0 for the per-sector move_window() baseline.
+ */
+FRESULT dev_bench_getfree(const TCHAR *path, struct dev_getfree_result *res);
+
+struct dev_unlink_result {
+  uint32_t cycles;          /* SMCLK cycles spent in f_unlink() */
+  uint32_t reads;           /* disk_read calls */
+  uint32_t writes;          /* disk_write calls */
+  uint32_t wr_sects;        /* sectors written */
+};
+
+/**
+ * dev_bench_unlink(): Times deleting a file
+ * @path:  File to delete
+ * @res:   Filled with the cycles and DiskStats deltas
+ *
+ * Build with _FAT_SCAN_SECTS 0 for the per-cluster put_fat() baseline.
+ */
+FRESULT dev_bench_unlink(const TCHAR *path, struct dev_unlink_result *res);
+
+struct dev_records_result {
+  uint32_t cycles;          /* SMCLK cycles for all records and the f_sync() */
+  uint32_t writes;          /* disk_write calls */
+  uint32_t wr_sects;        /* sectors written */
+};
+
+/**
+ * dev_bench_records(): Times a stream of small records
+ * @fp:    File open with FA_WRITE
+ * @nrec:  32 byte records to append
+ * @res:   Filled with the cycles and DiskStats deltas
+ *
+ * With _FS_TINY 0 and a buffer from the _FS_MBUF pool, the completed sectors
+ * reach the card in multi-block writes; build with _FS_MBUF 0 for the one
+ * disk_write per sector baseline.
+ */
+FRESULT dev_bench_records(FIL *fp, uint16_t nrec, struct dev_records_result *res);
+
+struct dev_chain_result {
+  uint32_t links;           /* cluster links followed */
+  uint32_t cycles;          /* SMCLK cycles for the whole walk */
+  uint16_t per_link;        /* cycles per link, get_fat() included */
+  uint32_t reads;           /* disk_read calls */
+};
+
+/**
+ * dev_bench_chain(): Times following a file's cluster chain
+ * @fp:   File open for reading, several clusters long
+ * @res:  Filled with the link count, cycles and DiskStats delta
+ *
+ * f_lseek() to the end of the file takes one get_fat() per cluster. For a
+ * contiguous file, consecutive links share the FAT sector held in fs->win, so
+ * per_link is mostly the cost of get_fat() itself; build with _FS_FAT32_ONLY
+ * 0 and 1 to compare.
+ */
+FRESULT dev_bench_chain(FIL *fp, struct dev_chain_result *res);
+
+
+struct dev_spi_result {
+  uint8_t ramfunc;          /* SD_PLACE_RAMFUNC of this build */
+  uint32_t rd_sram;         /* cycles per sector read into an SRAM buffer */
+  uint32_t rd_fram;         /* cycles per sector read into an upper FRAM buffer */
+  uint32_t wr_sram;         /* cycles per sector written from the SRAM buffer */
+  uint32_t wr_fram;         /* cycles per sector written from the FRAM buffer */
+};
+
+/**
+ * dev_bench_spi_block(): Times the SPI sector transfer loops
+ * @sector:  First card sector to use, outside any open file
+ * @count:   Sectors to average over
+ * @res:     Filled with cycles per sector for each buffer placement
+ *
+ * Each sector is read with single block reads into an SRAM and an FRAM
+ * buffer, then written back from both, below the FRAM cache so every call
+ * reaches the card. The data is unchanged. Build with SD_PLACE_RAMFUNC 0 and
+ * 1 to compare the transfer routines in FRAM and in SRAM. Write figures
+ * include the card's programming time, so compare them on the same sectors.
+ */
+DRESULT dev_bench_spi_block(DWORD sector, UINT count, struct dev_spi_result *res);
+
+
+struct dev_fwrite_result {
+  uint16_t calls;           /* f_write() calls timed */
+  uint32_t cycles;          /* SMCLK cycles over all calls */
+  uint32_t per_call;        /* average cycles per call */
+  uint32_t max_call;        /* slowest call, usually one that allocated a cluster */
+};
+
+/**
+ * dev_bench_fwrite(): Times f_write() call by call
+ * @fp:     File open with FA_WRITE
+ * @btw:    Bytes per call, 1..512
+ * @calls:  Number of calls
+ * @res:    Filled with the cycle counts
+ *
+ * Sector and cluster arithmetic in f_write() is shift and mask work, so what
+ * is left of the multiply cost is in the card driver and the FAT code. Build
+ * with HWMULT=none and HWMULT=f5series (makefile) to compare.
+ */
+FRESULT dev_bench_fwrite(FIL *fp, UINT btw, uint16_t calls, struct dev_fwrite_result *res);
+
+
+struct dev_irq_result {
+  uint16_t max_off;         /* longest interrupts-off window in the SPI layer, cycles */
+  uint16_t max_latency;     /* worst TA0CCR1 latency while the card was selected, cycles */
+  uint32_t isr_calls;       /* probe interrupts taken while the card was selected */
+  uint32_t cycles;          /* SMCLK cycles for the writes and the f_sync() */
+};
+
+/**
+ * dev_check_irq_latency(): Measures interrupt response under card traffic
+ * @fp:       File open with FA_WRITE
+ * @sectors:  512 byte writes to make, followed by an f_sync()
+ * @period:   SMCLK cycles between probe interrupts, 64 or more
+ * @res:      Filled from IrqStats (diskio.h)
+ *
+ * Runs the cycle counter with a TA0CCR1 interrupt every @period cycles whose
+ * handler passes its due count to disk_irq_latency(). max_latency includes
+ * interrupt entry and the handler prologue, so compare it with the figure
+ * for an idle bus. max_off stays 0 with _SPI_IRQ_OPEN; build with 0 to see
+ * the per-byte masking window. Interrupts are enabled for the duration.
+ */
+FRESULT dev_check_irq_latency(FIL *fp, uint16_t sectors, uint16_t period, struct dev_irq_result *res);
+
 #endif
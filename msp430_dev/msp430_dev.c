@@ -1,7 +1,15 @@
 #include "../msp430_dev.h"
+#include "../sdcard/sd_memops.h"
+#include "../sdlog/dvz.h"
+#include "../sdcard/ff.h"
+#include "../sdcard/diskio.h"
+#include "../sdcard/sd_place.h"
 #include <stdint.h>
 #include <msp430fr5994.h>
 
+static volatile uint16_t cycle_overflows;   // TA0 wraps since dev_cycles_start()
+static uint16_t probe_period;               // TA0CCR1 step of dev_check_irq_latency()
+
 void dev_init_led(void)
 {
     P1DIR |= BIT0 | BIT1;
@@ -36,9 +44,359 @@ void dev_end(void)
 
 void dev_clear_memory(uint16_t *start, uint16_t *end)
 {
-  uint16_t *temp = start;
-  while (temp <= end) {
-    *temp = 0;
-    temp++;
+  // Cleared in chunks so each fits one DMA block transfer (DMAxSZ is 16 bits)
+  while (start <= end) {
+    unsigned long left = (unsigned long)(end - start) + 1;
+    unsigned int words = left > 0x4000 ? 0x4000 : (unsigned int)left;
+    sd_mem_set(start, 0, words * 2);
+    start += words;
+  }
+}
+
+void dev_cycles_start(void)
+{
+  TA0CTL = MC__STOP | TACLR;
+  cycle_overflows = 0;
+  TA0CTL = TASSEL__SMCLK | MC__CONTINUOUS | TAIE;
+}
+
+uint32_t dev_cycles_stop(void)
+{
+  uint16_t lo = TA0R;
+  TA0CTL &= ~(MC__CONTINUOUS | TAIE);
+  uint16_t hi = cycle_overflows;
+  if ((TA0CTL & TAIFG) && lo < 0x8000)  // Wrapped but the ISR has not run yet
+    hi++;
+  TA0CTL &= ~TAIFG;
+  return ((uint32_t)hi << 16) | lo;
+}
+
+void __attribute__((interrupt(TIMER0_A1_VECTOR))) dev_timer0_a1_isr(void)
+{
+  switch (TA0IV) {
+  case TA0IV_TACCR1:                    // Latency probe, due at TA0CCR1
+    disk_irq_latency(TA0CCR1);
+    TA0CCR1 += probe_period;
+    break;
+  case TA0IV_TAIFG:                     // Counter overflow
+    cycle_overflows++;
+    break;
+  }
+}
+
+// Reference: the byte loop FatFs used before sd_memops
+static void __attribute__((noinline)) byte_cpy(void *dst, const void *src, unsigned int cnt)
+{
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  while (cnt--)
+    *d++ = *s++;
+}
+
+void dev_bench_memops(struct dev_memops_result *res)
+{
+  static const uint16_t sizes[DEV_BENCH_MEMOPS_SIZES] = {11, 32, 64, 128, 256, 512};
+  static uint16_t a[256], b[256];         // Word aligned, 512 bytes each
+
+  for (int i = 0; i < DEV_BENCH_MEMOPS_SIZES; i++) {
+    uint16_t n = sizes[i];
+    res[i].size = n;
+
+    dev_cycles_start();
+    byte_cpy(a, b, n);
+    res[i].cpy_byte = (uint16_t)dev_cycles_stop();
+
+    dev_cycles_start();
+    sd_mem_cpy_word(a, b, n);
+    res[i].cpy_word = (uint16_t)dev_cycles_stop();
+
+    dev_cycles_start();
+    sd_mem_cpy_dma(a, b, n);
+    res[i].cpy_dma = (uint16_t)dev_cycles_stop();
+
+    dev_cycles_start();
+    sd_mem_set_word(a, 0, n);
+    res[i].set_word = (uint16_t)dev_cycles_stop();
+
+    dev_cycles_start();
+    sd_mem_set_dma(b, 0, n);
+    res[i].set_dma = (uint16_t)dev_cycles_stop();
+
+    dev_cycles_start();
+    sd_mem_cmp(a, b, n);
+    res[i].cmp_word = (uint16_t)dev_cycles_stop();
+  }
+}
+
+// Fills @frames with the next part of sample stream @kind (3 channels)
+static void bench_stream(int kind, int16_t (*frames)[3], uint16_t n, uint32_t *t, uint32_t *lcg)
+{
+  for (uint16_t i = 0; i < n; i++, (*t)++) {
+    for (int c = 0; c < 3; c++) {
+      *lcg = *lcg * 1103515245UL + 12345;
+      int16_t noise = (int16_t)(*lcg >> 16);
+      switch (kind) {
+      case 0:                             // Drift: one count every 16 samples
+        frames[i][c] = (int16_t)(2000 + c * 100 + (*t >> 4));
+        break;
+      case 1:                             // Triangle, +-1024 over 512 samples
+        frames[i][c] = (int16_t)(((*t + c * 64) & 0x100) ? 1024 - ((*t + c * 64) & 0xFF) * 8
+                                                         : -1024 + ((*t + c * 64) & 0xFF) * 8);
+        break;
+      case 2:                             // Accelerometer: 1 g on Z plus +-32 noise
+        frames[i][c] = (int16_t)((c == 2 ? 16384 : 0) + (noise >> 10));
+        break;
+      default:                            // Full-scale noise
+        frames[i][c] = noise;
+        break;
+      }
+    }
   }
 }
+
+void dev_bench_compress(struct dev_compress_result *res, uint32_t smclk_hz)
+{
+  static struct dvz_enc enc;
+  static int16_t frames[256][3];
+
+  for (int k = 0; k < DEV_BENCH_COMPRESS_STREAMS; k++) {
+    uint32_t t = 0, lcg = 1, cycles = 0;
+
+    dvz_init(&enc, 0, 3);
+    for (int pass = 0; pass < 4; pass++) {
+      bench_stream(k, frames, 256, &t, &lcg);
+      dev_cycles_start();
+      for (uint16_t i = 0; i < 256; i++)
+        dvz_put(&enc, frames[i]);
+      cycles += dev_cycles_stop();
+    }
+
+    res[k].raw_bytes = enc.raw_bytes;
+    res[k].out_bytes = enc.out_bytes + enc.pos;
+    res[k].cycles = cycles;
+    res[k].ratio_x100 = (uint16_t)(enc.raw_bytes * 100 / res[k].out_bytes);
+    res[k].bytes_per_sec = (uint32_t)((uint64_t)enc.raw_bytes * smclk_hz / cycles);
+  }
+}
+
+int dev_check_sync_reads(FIL *fp, uint16_t cycles, struct dev_sync_check *res)
+{
+  static uint8_t chunk[512];
+  UINT bw;
+
+  res->cycles = 0;
+  res->alloc_cycles = 0;
+  res->reread_cycles = 0;
+  res->reads = 0;
+
+  for (uint16_t i = 0; i < cycles; i++) {
+    uint32_t reads = DiskStats.reads;
+    DWORD clust = fp->clust;
+
+    if (f_write(fp, chunk, sizeof chunk, &bw) != FR_OK || bw != sizeof chunk || f_sync(fp) != FR_OK)
+      return -1;
+    reads = DiskStats.reads - reads;
+    res->reads += reads;
+
+    if (i == 0)                           // Warm-up: brings the directory sector in
+      continue;
+    res->cycles++;
+    if (fp->clust != clust)
+      res->alloc_cycles++;
+    else if (reads)
+      res->reread_cycles++;
+  }
+
+  return res->reread_cycles ? 1 : 0;
+}
+
+
+FRESULT dev_bench_getfree(const TCHAR *path, struct dev_getfree_result *res)
+{
+  FATFS *fs;
+  FRESULT rc;
+  uint32_t reads, sects;
+
+  rc = f_getfree(path, &res->free_clust, &fs);  // Mounts the volume
+  if (rc != FR_OK)
+    return rc;
+
+  fs->free_clust = 0xFFFFFFFF;                   // Force a full scan
+  reads = DiskStats.reads;
+  sects = DiskStats.rd_sects;
+  dev_cycles_start();
+  rc = f_getfree(path, &res->free_clust, &fs);
+  res->cycles = dev_cycles_stop();
+  res->reads = DiskStats.reads - reads;
+  res->rd_sects = DiskStats.rd_sects - sects;
+  return rc;
+}
+
+
+FRESULT dev_bench_unlink(const TCHAR *path, struct dev_unlink_result *res)
+{
+  FRESULT rc;
+  uint32_t reads = DiskStats.reads, writes = DiskStats.writes, sects = DiskStats.wr_sects;
+
+  dev_cycles_start();
+  rc = f_unlink(path);
+  res->cycles = dev_cycles_stop();
+  res->reads = DiskStats.reads - reads;
+  res->writes = DiskStats.writes - writes;
+  res->wr_sects = DiskStats.wr_sects - sects;
+  return rc;
+}
+
+
+FRESULT dev_bench_records(FIL *fp, uint16_t nrec, struct dev_records_result *res)
+{
+  static uint8_t rec[32];
+  FRESULT rc = FR_OK;
+  UINT bw;
+  uint32_t writes = DiskStats.writes, sects = DiskStats.wr_sects;
+
+  dev_cycles_start();
+  for (uint16_t i = 0; i < nrec && rc == FR_OK; i++) {
+    rec[0] = (uint8_t)i;
+    rec[1] = (uint8_t)(i >> 8);
+    rc = f_write(fp, rec, sizeof rec, &bw);
+    if (rc == FR_OK && bw != sizeof rec)
+      rc = FR_DENIED;                       // Volume full
+  }
+  if (rc == FR_OK)
+    rc = f_sync(fp);
+  res->cycles = dev_cycles_stop();
+  res->writes = DiskStats.writes - writes;
+  res->wr_sects = DiskStats.wr_sects - sects;
+  return rc;
+}
+
+
+FRESULT dev_bench_chain(FIL *fp, struct dev_chain_result *res)
+{
+  FRESULT rc;
+  uint32_t reads;
+  DWORD csz = (DWORD)fp->fs->csize * _MAX_SS;
+
+  res->links = f_size(fp) ? (f_size(fp) - 1) / csz : 0;
+  rc = f_lseek(fp, 0);
+  if (rc != FR_OK)
+    return rc;
+  reads = DiskStats.reads;
+  dev_cycles_start();
+  rc = f_lseek(fp, f_size(fp));
+  res->cycles = dev_cycles_stop();
+  res->reads = DiskStats.reads - reads;
+  res->per_link = res->links ? (uint16_t)(res->cycles / res->links) : 0;
+  return rc;
+}
+
+
+DRESULT dev_bench_spi_block(DWORD sector, UINT count, struct dev_spi_result *res)
+{
+  static BYTE sram_buf[512] SD_SRAM_BSS;
+  static BYTE fram_buf[512] SD_FRAM_BSS;
+  DRESULT rc = RES_OK;
+  UINT i;
+
+  res->ramfunc = SD_PLACE_RAMFUNC;
+  res->rd_sram = res->rd_fram = res->wr_sram = res->wr_fram = 0;
+  if (!count)
+    return RES_PARERR;
+
+  for (i = 0; i < count && rc == RES_OK; i++) {
+    dev_cycles_start();
+    rc = mmc_disk_read(sram_buf, sector + i, 1);
+    res->rd_sram += dev_cycles_stop();
+    if (rc != RES_OK)
+      break;
+    dev_cycles_start();
+    rc = mmc_disk_read(fram_buf, sector + i, 1);
+    res->rd_fram += dev_cycles_stop();
+    if (rc != RES_OK)
+      break;
+    dev_cycles_start();
+    rc = mmc_disk_write(sram_buf, sector + i, 1);
+    res->wr_sram += dev_cycles_stop();
+    if (rc != RES_OK)
+      break;
+    dev_cycles_start();
+    rc = mmc_disk_write(fram_buf, sector + i, 1);
+    res->wr_fram += dev_cycles_stop();
+  }
+
+  res->rd_sram /= count;
+  res->rd_fram /= count;
+  res->wr_sram /= count;
+  res->wr_fram /= count;
+  return rc;
+}
+
+
+FRESULT dev_bench_fwrite(FIL *fp, UINT btw, uint16_t calls, struct dev_fwrite_result *res)
+{
+  static uint8_t chunk[512];
+  FRESULT rc = FR_OK;
+  UINT bw;
+
+  res->calls = 0;
+  res->cycles = res->per_call = res->max_call = 0;
+  if (!btw || btw > sizeof chunk)
+    return FR_INVALID_PARAMETER;
+
+  while (res->calls < calls && rc == FR_OK) {
+    chunk[0] = (uint8_t)res->calls;
+    dev_cycles_start();
+    rc = f_write(fp, chunk, btw, &bw);
+    uint32_t t = dev_cycles_stop();
+    if (rc == FR_OK && bw != btw)
+      rc = FR_DENIED;                       // Volume full
+    res->cycles += t;
+    if (t > res->max_call)
+      res->max_call = t;
+    res->calls++;
+  }
+  res->per_call = res->calls ? res->cycles / res->calls : 0;
+  return rc;
+}
+
+
+FRESULT dev_check_irq_latency(FIL *fp, uint16_t sectors, uint16_t period, struct dev_irq_result *res)
+{
+  static uint8_t chunk[512];
+  uint16_t gie = __get_SR_register() & GIE;
+  FRESULT rc = FR_OK;
+  UINT bw;
+
+  res->max_off = res->max_latency = 0;
+  res->isr_calls = 0;
+  res->cycles = 0;
+  if (!sectors || period < 64)
+    return FR_INVALID_PARAMETER;
+
+  IrqStats.max_off = IrqStats.max_latency = 0;
+  IrqStats.isr_calls = 0;
+  probe_period = period;
+
+  dev_cycles_start();
+  TA0CCR1 = TA0R + period;
+  TA0CCTL1 = CCIE;
+  __enable_interrupt();
+  for (uint16_t i = 0; i < sectors && rc == FR_OK; i++) {
+    chunk[0] = (uint8_t)i;
+    rc = f_write(fp, chunk, sizeof chunk, &bw);
+    if (rc == FR_OK && bw != sizeof chunk)
+      rc = FR_DENIED;                       // Volume full
+  }
+  if (rc == FR_OK)
+    rc = f_sync(fp);
+  TA0CCTL1 = 0;
+  res->cycles = dev_cycles_stop();
+  if (!gie)
+    __disable_interrupt();
+
+  res->max_off = IrqStats.max_off;
+  res->max_latency = IrqStats.max_latency;
+  res->isr_calls = IrqStats.isr_calls;
+  return rc;
+}
@@ -7,6 +7,7 @@
 #include "sdcard/ff.h"
 #include "sdcard/ffconf.h"
 #include "sdcard/integer.h"
+#include "sdcard/sd_place.h"
 
 #define ONE_BYTE 8
 #define TEST_BUFF_SIZE 150
@@ -17,7 +18,7 @@ volatile uint16_t *hifram;
 
 // Objects for sd card library usage
 FIL file;
-FATFS fatfs;
+FATFS fatfs SD_SRAM_BSS;   /* fs->win is on every sector transfer */
 DIR dir;
 FRESULT errCode;
 
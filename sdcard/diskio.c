@@ -13,17 +13,17 @@
 // Includes ------------------------------------------------------------------------------------------
 #include <stdint.h>
 #include <stdbool.h>
-#include <msp430fr5994.h>
 #include "./diskio.h"		/* FatFs lower layer API */
-#include "./sd_msp430fr5994_launchpad.h"  /* defines for working with launchpad */
+#include "./sd_spi.h"		/* SPI transport on the board traits (sd_board.h) */
+#include "./sd_place.h"		/* SD_RAMFUNC */
+#if _USE_FCACHE
+#include "./sd_fram_cache.h"	/* FRAM write-back cache */
+#endif
 
 
 
 // Defines -------------------------------------------------------------------------------------------
 
-// Define Functions
-#define DLY_US(n)       __delay_cycles(n * (MCLK_FREQUENCY / 1000000))   //Delay n microseconds
-
 // Definitions for MMC/SDC command 
 #define CMD0    (0x40+0)    	// GO_IDLE_STATE
 #define CMD1    (0x40+1)    	// SEND_OP_COND
@@ -41,72 +41,94 @@
 #define CMD55    (0x40+55)    	// APP_CMD
 #define CMD58    (0x40+58)    	// READ_OCR
 
-// Peripheral definitions for DK-TM4C123G board
+// The card driver is a template on the board traits (sd_board.h), so a
+// second card on another bus is one more instantiation. FatFs and the FRAM
+// cache reach the SD_BOARD card through the glue functions at the end.
+template <class Board>
+class mmc {
+public:
+	static DSTATUS initialize (void);
+	static DSTATUS status (void) { return Stat; }
+	static DRESULT read (BYTE *buff, DWORD sector, UINT count);
+	static DRESULT write (const BYTE *buff, DWORD sector, UINT count);
+	static DRESULT zero (DWORD sector, DWORD count);
+	static DRESULT ioctl (BYTE ctrl, void *buff);
+	static void timerproc (void);
+	static BYTE busy (void) { return Selected; }	// Non-zero while the card is selected
+	static const BYTE *cid (void) { return Cid; }	// CID read by initialize()
+
+private:
+	typedef sd_spi<Board> spi;
+
+	static volatile DSTATUS Stat;    	// Disk status
+	static volatile BYTE Timer1, Timer2;    	// 100Hz decrement timer
+	static BYTE CardType;            	// b0:MMC, b1:SDC, b2:Block addressing
+	static BYTE PowerFlag;     		// Indicates if "power" is on
+	static BYTE Cid[16];			// Card identification register
+	static volatile BYTE Selected;		// CS is asserted, for disk_irq_latency()
+
+	static void SELECT (void) { spi::select(); Selected = 1; }	// Asserts the CS pin to the card
+	static void DESELECT (void) { Selected = 0; spi::deselect(); }	// De-asserts (set high) the CS pin to the card
+	static void xmit_spi (BYTE dat);
+	static BYTE rcvr_spi (void);
+	static void rcvr_spi_m (BYTE *dst);
+	static BYTE wait_ready (void);
+	static void send_initial_clock_train (void);
+	static void power_on (void);
+	static void set_max_speed (void);
+	static void power_off (void);
+	static int chk_power (void);
+	static BOOL rcvr_datablock (BYTE *buff, UINT btr);
+	static BOOL xmit_datablock (const BYTE *buff, BYTE token);
+	static BYTE send_cmd (BYTE cmd, DWORD arg);
+	static BYTE send_cmd12 (void);
+};
+
+template <class Board> volatile DSTATUS mmc<Board>::Stat = STA_NOINIT;
+template <class Board> volatile BYTE mmc<Board>::Timer1;
+template <class Board> volatile BYTE mmc<Board>::Timer2;
+template <class Board> BYTE mmc<Board>::CardType;
+template <class Board> BYTE mmc<Board>::PowerFlag = 0;
+template <class Board> BYTE mmc<Board>::Cid[16];
+template <class Board> volatile BYTE mmc<Board>::Selected;
+
+typedef mmc<SD_BOARD> Card;			// The card behind disk_*() and mmc_disk_*()
+
+#if _USE_STATS
+DSTATS DiskStats;				// disk_read/disk_write counters
+#endif
+#if _USE_IRQSTATS
+ISTATS IrqStats;				// Interrupt-off windows and ISR latency under card traffic
+#endif
 
-// Individual pins from MSP430 connected to the SD Card are set up in the SPIpins.h folder (Platform dependent)
 
 // "Private" Functions ------------------------------------------------------------------------------
 
-// Asserts the CS pin to the card (Platform dependent)
-static void SELECT (void)
-{
-	CS_OUT_p &= ~(CS_b);
-}
-
+// The byte and block transfer routines run from SRAM (sd_place.h)
 
-// De-asserts (set high) the CS pin to the card (Platform dependent)
-static void DESELECT (void)
-{
-	CS_OUT_p |= CS_b;
+// Transmit a byte to MMC via SPI
+template <class Board>
+void SD_RAMFUNC mmc<Board>::xmit_spi(BYTE dat){
+	spi::xmit(dat);
 }
 
 
-static volatile DSTATUS Stat = STA_NOINIT;    	// Disk status
-static volatile BYTE Timer1, Timer2;    	// 100Hz decrement timer
-static BYTE CardType;            		// b0:MMC, b1:SDC, b2:Block addressing
-static BYTE PowerFlag = 0;     			// Indicates if "power" is on
-
-
-// Transmit a byte to MMC via SPI  (Platform dependent)                 
-static void __attribute__((section(".upper.text"))) xmit_spi(BYTE dat){
-	uint16_t gie = __get_SR_register() & GIE;	// Save interrupt state
-	__disable_interrupt();				// Disable interrupts
-
-	while(!(UCxxIFG & UCTXIFG));			// Wait for TX ready
-	UCxxTXBUF = dat;				// Write byte
-	while(UCxxSTATW & UCBUSY);
-
-	UCxxRXBUF;					// Read to empty RX buffer, clear any ovverrun
-
-	__bis_SR_register(gie);				// Reload interrupt state
+// Receive a byte from MMC via SPI
+template <class Board>
+BYTE SD_RAMFUNC mmc<Board>::rcvr_spi (void){
+	return spi::rcvr();
 }
 
 
-// Receive a byte from MMC via SPI  (Platform dependent)                
-static BYTE __attribute__((section(".upper.text"))) rcvr_spi (void){
-	uint8_t ui8RcvDat;				// Receive variable
-
-	uint16_t gie = __get_SR_register() & GIE;	// Save interrupt state
-	__disable_interrupt();
-
-	UCxxIFG &= ~UCRXIFG;				// Ensure RXIFG clear
-	while(!(UCxxIFG & UCTXIFG));			// Wait for TX ready
-	UCxxTXBUF = 0xFF;				// Send dummy byte
-	while(!(UCxxIFG & UCRXIFG));			// Wait for RX buffer
-
-	ui8RcvDat = UCxxRXBUF;				// Read RX buffer
-
-	return (BYTE)ui8RcvDat;
-}
-
-
-static void __attribute__((section(".upper.text"))) rcvr_spi_m (BYTE *dst){
+template <class Board>
+void SD_RAMFUNC mmc<Board>::rcvr_spi_m (BYTE *dst){
 	*dst = rcvr_spi();
 }
 
 
 // Wait for card ready 
-static BYTE __attribute__((section(".upper.text"))) wait_ready (void){
+template <class Board>
+BYTE __attribute__((section(".upper.text"))) mmc<Board>::wait_ready (void){
 	BYTE res;
 
 	Timer2 = 50;    				/* Wait for ready in timeout of 500ms */
@@ -120,7 +142,8 @@ static BYTE __attribute__((section(".upper.text"))) wait_ready (void){
 
 
 // Send 80 or so clock transitions with CS and DI held high. This is required after card power up to get it into SPI mode
-static void __attribute__((section(".upper.text"))) send_initial_clock_train(void){
+template <class Board>
+void __attribute__((section(".upper.text"))) mmc<Board>::send_initial_clock_train(void){
 	unsigned int i;
 	// uint8_t ui8RcvDat;				// Receive variable
 
@@ -136,51 +159,13 @@ static void __attribute__((section(".upper.text"))) send_initial_clock_train(voi
 
 // Power Control  (Platform dependent)
 // When the target system does not support socket power control, there is nothing to do in these functions and chk_power always returns 1.  
-static void __attribute__((section(".upper.text"))) power_on (void){
+template <class Board>
+void __attribute__((section(".upper.text"))) mmc<Board>::power_on (void){
 	/*
 	* This doesn't really turn the power on, but initializes the
-	* SSI port and pins needed to talk to the card.
+	* SPI port and pins needed to talk to the card.
 	*/
-
-	//Port initialization for SD Card operation
-	SCLK_SEL0_p &= ~(SCLK_b);
-	SCLK_SEL1_p |= SCLK_b;
-	MISO_SEL0_p &= ~(MISO_b);
-	MISO_SEL1_p |= MISO_b;
-	MOSI_SEL0_p &= ~(MOSI_b);
-	MOSI_SEL1_p |= MOSI_b;
-	SCLK_DIR_p |= SCLK_b;
-	MOSI_DIR_p |= MOSI_b;
-
-	CS_SEL0_p &= ~(CS_b);
-	CS_SEL1_p &= ~(CS_b);
-	CS_OUT_p |= CS_b;
-	CS_DIR_p |= CS_b;
-
-	MISO_REN_p |= MISO_b;
-	MOSI_REN_p |= MOSI_b;
-	MISO_OUT_p |= MISO_b;
-	MOSI_OUT_p |= MOSI_b;
-
-	//Initialize USCI_A1 for SPI Master operation
-	UCxxCTLW0 = UCSWRST;                                    //Put state machine in reset
-	UCxxCTLW0 |= UCCKPL | UCMSB | UCMST | UCMODE_0 | UCSYNC;  //3-pin, 8-bit SPI master
-	// //Clock polarity select - The inactive state is high
-	// //MSB first
-
-	// //this is a hack to fix the SMCLK to be 1MHZ   //left in from Amulet code incase it might be useful later...
-	// CSCTL3 &= ~DIVS_3;
-	// CSCTL3 |=  DIVS_3;
-	// //end hack 
-
-	//SMCLK is running at 16MHz on the bracelet!
-	//f_UCxCLK = 16MHz / UCxxBRO = 16MHz / 64 = 250kHz
-
-	UCxxCTLW0 |= UCSSEL_2;                          //Use SMCLK, keep RESET
-	UCxxBR0 = 64;                                   //Initial SPI clock must be <400kHz  //Note: did end up working with this value being 24, but clock would be running at 500kHz?
-	UCxxBR1 = 0;                                            
-	UCxxCTLW0 &= ~UCSWRST;                          //Release USCI state machine
-	UCxxIFG &= ~UCRXIFG;
+	spi::init();
 
 	// Set DI and CS high and apply more than 74 pulses to SCLK for the card
 	// to be able to accept a native command.
@@ -190,21 +175,21 @@ static void __attribute__((section(".upper.text"))) power_on (void){
 }
 
 
-// Set the SSI speed to the max setting
-static void __attribute__((section(".upper.text"))) set_max_speed(void)
+// Set the SPI clock to the max setting
+template <class Board>
+void __attribute__((section(".upper.text"))) mmc<Board>::set_max_speed(void)
 {
-    UCxxCTLW0 |= UCSWRST;                                    //Put state machine in reset
-    UCxxBR0 = 1;                                             //f_UCxCLK = 16MHz/64 = 250kHz
-    UCxxBR1 = 0;
-    UCxxCTLW0 &= ~UCSWRST;                                   //Release USCI state machine
-}// TODO: Check speeds
+	spi::set_divider(Board::br_fast);
+}
 
-static void __attribute__((section(".upper.text"))) power_off (void)
+template <class Board>
+void __attribute__((section(".upper.text"))) mmc<Board>::power_off (void)
 {
 	PowerFlag = 0;
 }
 
-static int __attribute__((section(".upper.text"))) chk_power(void)
+template <class Board>
+int __attribute__((section(".upper.text"))) mmc<Board>::chk_power(void)
 {
 	/* Socket power state: 0=off, 1=on */
 	return PowerFlag;
@@ -212,7 +197,8 @@ static int __attribute__((section(".upper.text"))) chk_power(void)
 
 
 /* Receive a data packet from MMC */
-static BOOL __attribute__((section(".upper.text"))) rcvr_datablock (
+template <class Board>
+BOOL SD_RAMFUNC mmc<Board>::rcvr_datablock (
     BYTE *buff,            		/* Data buffer to store received data */
     UINT btr            		/* Byte count (must be even number) */
 ){
@@ -238,8 +224,9 @@ static BOOL __attribute__((section(".upper.text"))) rcvr_datablock (
 
 /* Send a data packet to MMC */
 #if _READONLY == 0
-static BOOL xmit_datablock (
-    const BYTE *buff,    		/* 512 byte data block to be transmitted */
+template <class Board>
+BOOL SD_RAMFUNC mmc<Board>::xmit_datablock (
+    const BYTE *buff,    		/* 512 byte data block to be transmitted (0: zeros) */
     BYTE token            		/* Data/Stop token */
 ){
 	BYTE resp, wc;
@@ -250,10 +237,17 @@ static BOOL xmit_datablock (
 	xmit_spi(token);                    /* Xmit data token */
 	if (token != 0xFD) {    		/* Is data token */
 		wc = 0;
-		do {                            /* Xmit the 512 byte data block to MMC */
-		    xmit_spi(*buff++);
-		    xmit_spi(*buff++);
-		} while (--wc);
+		if (buff) {
+		    do {                        /* Xmit the 512 byte data block to MMC */
+			xmit_spi(*buff++);
+			xmit_spi(*buff++);
+		    } while (--wc);
+		} else {
+		    do {                        /* No buffer: xmit a block of zeros */
+			xmit_spi(0);
+			xmit_spi(0);
+		    } while (--wc);
+		}
 
 		xmit_spi(0xFF);                 /* CRC (Dummy) */
 		xmit_spi(0xFF);
@@ -268,7 +262,8 @@ static BOOL xmit_datablock (
 
 
 /* Send a command packet to MMC */
-static BYTE __attribute__((section(".upper.text"))) send_cmd (
+template <class Board>
+BYTE __attribute__((section(".upper.text"))) mmc<Board>::send_cmd (
     BYTE cmd,        			/* Command byte */
     DWORD arg        			/* Argument */
 ){
@@ -313,7 +308,8 @@ static BYTE __attribute__((section(".upper.text"))) send_cmd (
  * latest non-0xFF byte as the response code.
  *
  *-----------------------------------------------------------------------*/
-static BYTE __attribute__((section(".upper.text"))) send_cmd12 (void){
+template <class Board>
+BYTE __attribute__((section(".upper.text"))) mmc<Board>::send_cmd12 (void){
 	BYTE n, res, val;
 
 	/* For CMD12, we don't wait for the card to be idle before we send
@@ -349,13 +345,12 @@ static BYTE __attribute__((section(".upper.text"))) send_cmd12 (void){
 
 /* Initialize Disk Drive */
 // TODO: Check Timer function
-DSTATUS __attribute__((section(".upper.text"))) disk_initialize (
-    BYTE drv        				/* Physical drive nmuber (0) */
-){
+template <class Board>
+DSTATUS __attribute__((section(".upper.text"))) mmc<Board>::initialize (void)
+{
 	BYTE n, ty, ocr[4];
 
 
-	if (drv) return STA_NOINIT;            	/* Supports only single drive */
 	if (Stat & STA_NODISK) return Stat;    	/* No card in the socket */
 
 	power_on();                            	/* Force socket power on */
@@ -396,6 +391,10 @@ DSTATUS __attribute__((section(".upper.text"))) disk_initialize (
 	if (ty) {           		 	/* Initialization succeded */
 		Stat &= ~STA_NOINIT;        		/* Clear STA_NOINIT */
 		set_max_speed();
+		if (ioctl(MMC_GET_CID, Cid) != RES_OK) {	/* Unidentified cards are not used */
+		    Stat |= STA_NOINIT;
+		    power_off();
+		}
 	} else {            			/* Initialization failed */
 		power_off();
 	}
@@ -404,27 +403,17 @@ DSTATUS __attribute__((section(".upper.text"))) disk_initialize (
 }
 
 
-/* Get Disk Status */
-DSTATUS __attribute__((section(".upper.text"))) disk_status (
-    BYTE drv        			/* Physical drive nmuber (0) */
-){
-	if (drv) return STA_NOINIT;        	/* Supports only single drive */
-	return Stat;
-}
-
-
-
-/* Read Sector(s)  */
-DRESULT __attribute__((section(".upper.text"))) disk_read (
-    BYTE drv,            		/* Physical drive nmuber (0) */
+/* Read Sector(s) from the card */
+template <class Board>
+DRESULT __attribute__((section(".upper.text"))) mmc<Board>::read (
     BYTE *buff,            		/* Pointer to the data buffer to store read data */
     DWORD sector,       	  	/* Start sector number (LBA) */
     UINT count            		/* Sector count (1..255) */
 ){
-	if (drv || !count) return RES_PARERR;
+	if (!count) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-	if (!(CardType & 4)) sector *= 512;    	/* Convert to byte address if needed */
+	if (!(CardType & 4)) sector <<= 9;    	/* Convert to byte address if needed */
 
 	SELECT();            		   	/* CS = L */
 
@@ -451,19 +440,19 @@ DRESULT __attribute__((section(".upper.text"))) disk_read (
 
 
 
-/* Write Sector(s) */
+/* Write Sector(s) to the card */
 #if _READONLY == 0
-DRESULT __attribute__((section(".upper.text"))) disk_write (
-    BYTE drv,            			/* Physical drive nmuber (0) */
+template <class Board>
+DRESULT __attribute__((section(".upper.text"))) mmc<Board>::write (
     const BYTE *buff,    			/* Pointer to the data to be written */
     DWORD sector,       			/* Start sector number (LBA) */
     UINT count           			/* Sector count (1..255) */
 ){
-	if (drv || !count) return RES_PARERR;
+	if (!count) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 	if (Stat & STA_PROTECT) return RES_WRPRT;
 
-	if (!(CardType & 4)) sector *= 512;    	/* Convert to byte address if needed */
+	if (!(CardType & 4)) sector <<= 9;    	/* Convert to byte address if needed */
 
 	SELECT();           		 	/* CS = L */
 
@@ -491,23 +480,53 @@ DRESULT __attribute__((section(".upper.text"))) disk_write (
 
 	return count ? RES_ERROR : RES_OK;
 }
+
+
+/* Write zeros to a run of sectors with one multiple block write */
+template <class Board>
+DRESULT __attribute__((section(".upper.text"))) mmc<Board>::zero (
+    DWORD sector,       			/* Start sector number (LBA) */
+    DWORD count           			/* Sector count */
+){
+	if (!count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+	if (Stat & STA_PROTECT) return RES_WRPRT;
+
+	if (!(CardType & 4)) sector <<= 9;    	/* Convert to byte address if needed */
+
+	SELECT();           		 	/* CS = L */
+
+	if (CardType & 2) {
+	    send_cmd(CMD55, 0); send_cmd(CMD23, count);    /* ACMD23 */
+	}
+	if (send_cmd(CMD25, sector) == 0) {    	/* WRITE_MULTIPLE_BLOCK */
+	    do {
+		if (!xmit_datablock(0, 0xFC)) break;
+	    } while (--count);
+	    if (!xmit_datablock(0, 0xFD))    	/* STOP_TRAN token */
+		count = 1;
+	}
+
+	DESELECT();            			/* CS = H */
+	rcvr_spi();            			/* Idle (Release DO) */
+
+	return count ? RES_ERROR : RES_OK;
+}
 #endif /* _READONLY */
 
 
 
-/* Disk IO Control */
-DRESULT __attribute__((section(".upper.text"))) disk_ioctl (
-    BYTE drv,        				/* Physical drive nmuber (0) */
+/* Disk IO Control (power and card registers) */
+template <class Board>
+DRESULT __attribute__((section(".upper.text"))) mmc<Board>::ioctl (
     BYTE ctrl,        				/* Control code */
-    void *buff        				/* Buffer to send/receive control data */  //was void instead of Byte
+    void *buff        				/* Buffer to send/receive control data */
 ){
 	DRESULT res;
 	BYTE n, csd[16], *ptr = (BYTE*) buff;
 	WORD csize;
 
 
-	if (drv) return RES_PARERR;
-
 	res = RES_ERROR;
 
 	if (ctrl == CTRL_POWER) {
@@ -600,7 +619,8 @@ DRESULT __attribute__((section(".upper.text"))) disk_ioctl (
 /* Device Timer Interrupt Procedure  (Platform dependent)                */
 /* This function must be called in period of 10ms                        */
 // TODO: Timer function, CHECK!
-void __attribute__((section(".upper.text"))) disk_timerproc (void)
+template <class Board>
+void __attribute__((section(".upper.text"))) mmc<Board>::timerproc (void)
 {
 	//    BYTE n, s;
 	BYTE n;
@@ -612,6 +632,169 @@ void __attribute__((section(".upper.text"))) disk_timerproc (void)
 	if (n) Timer2 = --n;
 }
 
+
+
+// FatFs glue, drive 0 is the SD_BOARD card ---------------------------------------------------------
+
+
+
+/* Initialize Disk Drive */
+DSTATUS __attribute__((section(".upper.text"))) disk_initialize (
+    BYTE drv        				/* Physical drive nmuber (0) */
+){
+	DSTATUS stat;
+
+
+	if (drv) return STA_NOINIT;            	/* Supports only single drive */
+
+	stat = Card::initialize();
+#if _USE_FCACHE
+	if (!(stat & STA_NOINIT))
+		fcache_attach(Card::cid());		/* Replay sectors left in FRAM for this card */
+#endif
+	return stat;
+}
+
+
+/* Get Disk Status */
+DSTATUS __attribute__((section(".upper.text"))) disk_status (
+    BYTE drv        			/* Physical drive nmuber (0) */
+){
+	if (drv) return STA_NOINIT;        	/* Supports only single drive */
+	return Card::status();
+}
+
+
+/* Card access below the FRAM cache */
+DRESULT __attribute__((section(".upper.text"))) mmc_disk_read (BYTE *buff, DWORD sector, UINT count)
+{
+	return Card::read(buff, sector, count);
+}
+
+#if _READONLY == 0
+DRESULT __attribute__((section(".upper.text"))) mmc_disk_write (const BYTE *buff, DWORD sector, UINT count)
+{
+	return Card::write(buff, sector, count);
+}
+
+DRESULT __attribute__((section(".upper.text"))) mmc_disk_zero (DWORD sector, DWORD count)
+{
+	return Card::zero(sector, count);
+}
+#endif /* _READONLY */
+
+
+
+/* Read Sector(s)  */
+DRESULT __attribute__((section(".upper.text"))) disk_read (
+    BYTE drv,            		/* Physical drive nmuber (0) */
+    BYTE *buff,            		/* Pointer to the data buffer to store read data */
+    DWORD sector,       	  	/* Start sector number (LBA) */
+    UINT count            		/* Sector count (1..255) */
+){
+	if (drv || !count) return RES_PARERR;
+	if (Card::status() & STA_NOINIT) return RES_NOTRDY;
+#if _USE_STATS
+	DiskStats.reads++;
+	DiskStats.rd_sects += count;
+#endif
+
+#if _USE_FCACHE
+	return fcache_read(buff, sector, count);
+#else
+	return mmc_disk_read(buff, sector, count);
+#endif
+}
+
+
+
+/* Write Sector(s) */
+#if _READONLY == 0
+DRESULT __attribute__((section(".upper.text"))) disk_write (
+    BYTE drv,            			/* Physical drive nmuber (0) */
+    const BYTE *buff,    			/* Pointer to the data to be written */
+    DWORD sector,       			/* Start sector number (LBA) */
+    UINT count           			/* Sector count (1..255) */
+){
+	if (drv || !count) return RES_PARERR;
+	if (Card::status() & STA_NOINIT) return RES_NOTRDY;
+	if (Card::status() & STA_PROTECT) return RES_WRPRT;
+#if _USE_STATS
+	DiskStats.writes++;
+	DiskStats.wr_sects += count;
+#endif
+
+#if _USE_FCACHE
+	return fcache_write(buff, sector, count);	/* Durable once in FRAM, destaged lazily */
+#else
+	return mmc_disk_write(buff, sector, count);
+#endif
+}
+#endif /* _READONLY */
+
+
+
+/* Disk IO Control */
+DRESULT __attribute__((section(".upper.text"))) disk_ioctl (
+    BYTE drv,        				/* Physical drive nmuber (0) */
+    BYTE ctrl,        				/* Control code */
+    void *buff        				/* Buffer to send/receive control data */  //was void instead of Byte
+){
+	if (drv) return RES_PARERR;
+
+#if _USE_FCACHE
+	if (ctrl == CTRL_POWER && *(BYTE*)buff == 0	/* POWER_OFF */
+	    && !(Card::status() & STA_NOINIT) && fcache_flush() != RES_OK)
+		return RES_ERROR;			/* Keep the card up until the cache is destaged */
+#endif
+#if _READONLY == 0
+	if (ctrl == CTRL_ZERO_SECTORS) {
+		if (Card::status() & STA_NOINIT) return RES_NOTRDY;
+#if _USE_FCACHE
+		if (fcache_flush() != RES_OK)		/* No cached copy may land on the zeros later */
+		    return RES_ERROR;
+#endif
+#if _USE_STATS
+		DiskStats.writes++;
+		DiskStats.wr_sects += ((DWORD*)buff)[1];
+#endif
+		return mmc_disk_zero(((DWORD*)buff)[0], ((DWORD*)buff)[1]);
+	}
+#endif /* _READONLY */
+	if (ctrl == MMC_GET_CID) {			/* Read by initialize(), no bus traffic */
+		if (Card::status() & STA_NOINIT) return RES_NOTRDY;
+		for (BYTE i = 0; i < 16; i++) ((BYTE*)buff)[i] = Card::cid()[i];
+		return RES_OK;
+	}
+
+	return Card::ioctl(ctrl, buff);
+}
+
+
+
+/* Device Timer Interrupt Procedure  (Platform dependent)                */
+/* This function must be called in period of 10ms                        */
+void __attribute__((section(".upper.text"))) disk_timerproc (void)
+{
+	Card::timerproc();
+}
+
+
+#if _USE_IRQSTATS
+/* ISR latency probe: @due is the timer count that raised the calling     */
+/* interrupt. Only samples taken while the card is selected are recorded, */
+/* so IrqStats.max_latency is the worst the SPI traffic added.           */
+void __attribute__((section(".upper.text"))) disk_irq_latency (WORD due)
+{
+	WORD lat;
+
+	if (!Card::busy()) return;
+	lat = (WORD)(SD_BOARD::clock::read() - due);
+	if (lat > IrqStats.max_latency) IrqStats.max_latency = lat;
+	IrqStats.isr_calls++;
+}
+#endif
+
 /*---------------------------------------------------------*/
 /* User Provided Timer Function for FatFs module           */
 /*---------------------------------------------------------*/
@@ -11,6 +11,10 @@ extern "C" {
 
 #define _USE_WRITE	1	/* 1: Enable disk_write function */
 #define _USE_IOCTL	1	/* 1: Enable disk_ioctl fucntion */
+#define _USE_FCACHE	1	/* 1: Route disk_read/disk_write through the FRAM write-back cache (sd_fram_cache.c) */
+#define _USE_STATS	1	/* 1: Count disk_read/disk_write calls in DiskStats */
+#define _USE_IRQSTATS	1	/* 1: Record interrupt-off windows and ISR latency in IrqStats */
+#define _SPI_IRQ_OPEN	1	/* 1: Leave interrupts enabled through SPI transfers, 0: Mask them for each byte */
 
 #include "integer.h"
 
@@ -28,6 +32,30 @@ typedef enum {
 } DRESULT;
 
 
+#if _USE_STATS
+/* Access counters, as seen by FatFs (above the FRAM cache) */
+typedef struct {
+	DWORD	reads;		/* disk_read calls */
+	DWORD	writes;		/* disk_write calls */
+	DWORD	rd_sects;	/* Sectors read */
+	DWORD	wr_sects;	/* Sectors written */
+} DSTATS;
+
+extern DSTATS DiskStats;
+#endif
+
+#if _USE_IRQSTATS
+/* Interrupt timing around card transfers, in ticks of the board clock (sd_board.h) */
+typedef struct {
+	WORD	max_off;	/* Longest window the SPI layer ran with interrupts masked */
+	WORD	max_latency;	/* Longest latency passed to disk_irq_latency() during a transfer */
+	DWORD	isr_calls;	/* disk_irq_latency() calls during a transfer */
+} ISTATS;
+
+extern ISTATS IrqStats;
+#endif
+
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
@@ -38,6 +66,22 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* Card access below the FRAM cache (no drive number, card must be initialized) */
+DRESULT mmc_disk_read (BYTE* buff, DWORD sector, UINT count);
+DRESULT mmc_disk_write (const BYTE* buff, DWORD sector, UINT count);
+DRESULT mmc_disk_zero (DWORD sector, DWORD count);
+
+#if _USE_IRQSTATS
+/* Called by a timer ISR with the compare value that raised it */
+void disk_irq_latency (WORD due);
+#endif
+
+#ifndef __MSP430__
+/* Host builds: serve drive 0 from a card image file (diskio_image.c) */
+int disk_image_open (const char* path, int writable);
+void disk_image_close (void);
+#endif
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -60,6 +104,7 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define CTRL_LOCK			6	/* Lock/Unlock media removal */
 #define CTRL_EJECT			7	/* Eject media */
 #define CTRL_FORMAT			8	/* Create physical format on the media */
+#define CTRL_ZERO_SECTORS	9	/* Fill a block of sectors with zeros, DWORD[2] {start, count} */
 
 /* MMC/SDC specific ioctl command */
 #define MMC_GET_TYPE		10	/* Get card type */
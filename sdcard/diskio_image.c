@@ -0,0 +1,172 @@
+/*-----------------------------------------------------------------------*/
+/* Card image back end for host builds                                    */
+/*-----------------------------------------------------------------------*/
+/* Stands in for the SPI driver in diskio.c when FatFs and the sdlog      */
+/* readers are built on a PC, so logs can be analysed offline straight    */
+/* from a dump of the card (dd if=/dev/sdX of=card.img). Not built for    */
+/* the MSP430.                                                            */
+/*-----------------------------------------------------------------------*/
+
+#ifndef __MSP430__
+
+#define _FILE_OFFSET_BITS 64		/* 64 bit off_t on 32 bit hosts too */
+#define _POSIX_C_SOURCE 200112L		/* fseeko(), ftello() under -std=c99 */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "./diskio.h"		/* FatFs lower layer API */
+
+static FILE *Img;				/* Open image, NULL: no disk */
+static DSTATUS Stat = STA_NOINIT;		/* Disk status */
+static DWORD Attach;				/* Images attached so far, stands in for the card's CID */
+#if _USE_STATS
+DSTATS DiskStats;				/* disk_read/disk_write counters */
+#endif
+
+
+/* Attach an image file as drive 0 */
+int disk_image_open (
+    const char *path,				/* Image file (raw card dump) */
+    int writable				/* 0: read only */
+){
+	disk_image_close();
+	Img = fopen(path, writable ? "r+b" : "rb");
+	if (!Img) return 0;
+	Stat = STA_NOINIT | (writable ? 0 : STA_PROTECT);
+	Attach++;
+	return 1;
+}
+
+
+/* Detach the image */
+void disk_image_close (void)
+{
+	if (Img) fclose(Img);
+	Img = NULL;
+	Stat = STA_NOINIT | STA_NODISK;
+}
+
+
+/* Seek to a sector, images past 2GB need the 64 bit off_t */
+static int seek_sector (DWORD sector)
+{
+	return fseeko(Img, (off_t)sector * 512, SEEK_SET) == 0;
+}
+
+
+DSTATUS disk_initialize (
+    BYTE drv        				/* Physical drive nmuber (0) */
+){
+	if (drv) return STA_NOINIT;
+	if (!Img) return STA_NOINIT | STA_NODISK;
+	Stat &= ~STA_NOINIT;
+	return Stat;
+}
+
+
+DSTATUS disk_status (
+    BYTE drv        				/* Physical drive nmuber (0) */
+){
+	if (drv) return STA_NOINIT;
+	return Stat;
+}
+
+
+DRESULT disk_read (
+    BYTE drv,            			/* Physical drive nmuber (0) */
+    BYTE *buff,            			/* Pointer to the data buffer to store read data */
+    DWORD sector,       	  		/* Start sector number (LBA) */
+    UINT count            			/* Sector count */
+){
+	if (drv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+#if _USE_STATS
+	DiskStats.reads++;
+	DiskStats.rd_sects += count;
+#endif
+
+	if (!seek_sector(sector) || fread(buff, 512, count, Img) != count)
+		return RES_ERROR;
+	return RES_OK;
+}
+
+
+DRESULT disk_write (
+    BYTE drv,            			/* Physical drive nmuber (0) */
+    const BYTE *buff,    			/* Pointer to the data to be written */
+    DWORD sector,       			/* Start sector number (LBA) */
+    UINT count           			/* Sector count */
+){
+	if (drv || !count) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+	if (Stat & STA_PROTECT) return RES_WRPRT;
+#if _USE_STATS
+	DiskStats.writes++;
+	DiskStats.wr_sects += count;
+#endif
+
+	if (!seek_sector(sector) || fwrite(buff, 512, count, Img) != count)
+		return RES_ERROR;
+	return RES_OK;
+}
+
+
+DRESULT disk_ioctl (
+    BYTE drv,        				/* Physical drive nmuber (0) */
+    BYTE ctrl,        				/* Control code */
+    void *buff        				/* Buffer to send/receive control data */
+){
+	off_t end;
+
+	if (drv) return RES_PARERR;
+	if (Stat & STA_NOINIT) return RES_NOTRDY;
+
+	switch (ctrl) {
+	case CTRL_SYNC :
+		return fflush(Img) == 0 ? RES_OK : RES_ERROR;
+
+	case GET_SECTOR_COUNT :
+		if (fseeko(Img, 0, SEEK_END) != 0 || (end = ftello(Img)) < 0)
+			return RES_ERROR;
+		*(DWORD*)buff = (DWORD)(end / 512);
+		return RES_OK;
+
+	case GET_SECTOR_SIZE :
+		*(WORD*)buff = 512;
+		return RES_OK;
+
+	case GET_BLOCK_SIZE :
+		*(DWORD*)buff = 1;
+		return RES_OK;
+
+	case MMC_GET_CID : {			/* Each attach looks like another card */
+		BYTE *cid = (BYTE*)buff;
+		int i;
+
+		for (i = 0; i < 16; i++) cid[i] = 0;
+		cid[9] = (BYTE)(Attach >> 24); cid[10] = (BYTE)(Attach >> 16);	/* Product serial number */
+		cid[11] = (BYTE)(Attach >> 8); cid[12] = (BYTE)Attach;
+		return RES_OK;
+	}
+
+	case CTRL_ZERO_SECTORS : {
+		static const BYTE zero[512] = {0};
+		DWORD n = ((DWORD*)buff)[1];
+
+		if (Stat & STA_PROTECT) return RES_WRPRT;
+#if _USE_STATS
+		DiskStats.writes++;
+		DiskStats.wr_sects += n;
+#endif
+		if (!seek_sector(((DWORD*)buff)[0])) return RES_ERROR;
+		for ( ; n; n--) {
+			if (fwrite(zero, 512, 1, Img) != 1) return RES_ERROR;
+		}
+		return RES_OK;
+	}
+	}
+
+	return RES_PARERR;
+}
+
+#endif /* __MSP430__ */
@@ -4,7 +4,13 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of disk I/O functions */
+#if _USE_MEMOPS
+#include "sd_memops.h"	/* Word-wide/DMA memory operations */
+#endif
+#include "sd_place.h"		/* SRAM/FRAM buffer placement */
+#ifdef __MSP430__
 #include <msp430fr5994.h>
+#endif
 
 /*--------------------------------------------------------------------------
 
@@ -17,6 +23,22 @@
 #endif
 
 
+/* File data goes through fs->win only in the tiny configuration without a */
+/* pool of data sector buffers. Otherwise every file works on its buf[].   */
+#define _FS_DATAWIN	(_FS_TINY && !_FS_DATABUFS)
+#if _FS_TINY && _FS_DATABUFS && _FS_REENTRANT && _VOLUMES >= 2
+#error DataBuf[] is shared by all volumes, so it cannot be used by two volumes at once.
+#endif
+
+/* FAT sub-type of a mounted volume. In the FAT32 only configuration it is */
+/* a constant, so the FAT12/16 branches on it are dropped by the compiler. */
+#if _FS_FAT32_ONLY
+#define FS_TYPE(fs)	FS_FAT32
+#else
+#define FS_TYPE(fs)	((fs)->fs_type)
+#endif
+
+
 /* Reentrancy related */
 #if _FS_REENTRANT
 #if _USE_LFN == 1
@@ -452,6 +474,11 @@ const BYTE ExCvt[] = _EXCVT;	/* Upper conversion table for extended characters *
 /* String functions                                                      */
 /*-----------------------------------------------------------------------*/
 
+#if _USE_MEMOPS
+#define mem_cpy(dst,src,cnt)	sd_mem_cpy(dst,src,cnt)	/* Copy memory to memory */
+#define mem_set(dst,val,cnt)	sd_mem_set(dst,val,cnt)	/* Fill memory */
+#define mem_cmp(dst,src,cnt)	sd_mem_cmp(dst,src,cnt)	/* Compare memory to memory */
+#else
 /* Copy memory to memory */
 static
 void __attribute__((section(".upper.text"))) mem_cpy (void* dst, const void* src, UINT cnt) {
@@ -487,6 +514,7 @@ int __attribute__((section(".upper.text"))) mem_cmp (const void* dst, const void
 	while (cnt-- && (r = *d++ - *s++) == 0) ;
 	return r;
 }
+#endif /* _USE_MEMOPS */
 
 /* Check if chr is contained in the string */
 static
@@ -642,6 +670,179 @@ void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Metadata journal                                                      */
+/*-----------------------------------------------------------------------*/
+/* FAT, directory and FSINFO sectors written back by the file system go  */
+/* to journal slots instead of the disk, and reads take the newest slot  */
+/* image. A slot is not rewritten once committed, so the disk plus the   */
+/* slots below JrnHdr.commit always make up a consistent volume. sync_fs */
+/* commits a batch with one store. The committed images are copied home */
+/* once half the journal is used, when a batch fills it, on unmount and, */
+/* after a power loss, by find_volume(). Images are kept apart from their */
+/* sector numbers, so slots journaled in sector order lie back to back   */
+/* and go home, and to each FAT copy, as one multi-block write.          */
+#if !_FS_READONLY && _FS_JOURNAL
+#if _VOLUMES >= 2
+#error The metadata journal serves a single volume.
+#endif
+#if _FS_JOURNAL < 4 || _FS_JOURNAL > 64
+#error Wrong _FS_JOURNAL setting
+#endif
+
+typedef struct {
+	DWORD	vol;			/* Start sector of the journaled volume */
+	DWORD	vsn;			/* Its volume serial number */
+	UINT	count;			/* Slots in use */
+	volatile UINT commit;	/* Slots committed, the others are dropped on power loss */
+} JRNHDR;
+
+#ifdef __MSP430__		/* Kept over power cycles, like the FRAM sector cache */
+static JRNHDR JrnHdr __attribute__((persistent)) = {0};
+static DWORD JrnSect[_FS_JOURNAL] __attribute__((persistent)) = {0};	/* Sector each image belongs to */
+static BYTE JrnData[_FS_JOURNAL][_MAX_SS] __attribute__((persistent)) = {{0}};	/* Sector images */
+#else
+static JRNHDR JrnHdr;
+static DWORD JrnSect[_FS_JOURNAL];
+static BYTE JrnData[_FS_JOURNAL][_MAX_SS];
+#endif
+
+
+static
+UINT __attribute__((section(".upper.text"))) jrn_find (	/* Newest slot below end holding the sector, _FS_JOURNAL:None */
+	DWORD sect,		/* Sector number */
+	UINT end		/* Slots to search */
+)
+{
+	while (end--) {
+		if (JrnSect[end] == sect) return end;
+	}
+	return _FS_JOURNAL;
+}
+
+
+static
+int __attribute__((section(".upper.text"))) jrn_read (	/* 1:Loaded from the journal, 0:Not journaled */
+	FATFS* fs,		/* File system object */
+	BYTE* buf,		/* Sector buffer */
+	DWORD sect		/* Sector number */
+)
+{
+	UINT i = jrn_find(sect, JrnHdr.count);
+
+
+	if (i == _FS_JOURNAL) return 0;
+	mem_cpy(buf, JrnData[i], SS(fs));
+	return 1;
+}
+
+
+#if _FAT_SCAN_SECTS
+static
+void __attribute__((section(".upper.text"))) jrn_patch (	/* Lay journaled images over a multi-sector read */
+	FATFS* fs,		/* File system object */
+	BYTE* buf,		/* Sectors read from the disk */
+	DWORD sect,		/* First sector in buf */
+	UINT cnt		/* Sectors in buf */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < JrnHdr.count; i++) {	/* Oldest first, so the newest image lands last */
+		if (JrnSect[i] - sect < cnt)
+			mem_cpy(buf + (JrnSect[i] - sect) * SS(fs), JrnData[i], SS(fs));
+	}
+}
+#endif
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) jrn_apply (	/* Write the committed images home and empty the journal */
+	FATFS* fs		/* File system object */
+)
+{
+	DWORD sect;
+	UINT i, n, nf, fat;
+
+
+	for (i = 0; i < JrnHdr.commit; i += n) {
+		sect = JrnSect[i];
+		fat = (sect - fs->fatbase < fs->fsize);
+		for (n = 1; i + n < JrnHdr.commit && JrnSect[i + n] == sect + n	/* Run of consecutive sectors, */
+			&& (JrnSect[i + n] - fs->fatbase < fs->fsize) == fat; n++) ;	/* not crossing the FAT end */
+		if (n == 1 && jrn_find(sect, JrnHdr.commit) != i) continue;	/* A newer committed image follows */
+		if (disk_write(fs->drv, JrnData[i], sect, n))	/* An older image in a run is overwritten by its newer one later */
+			return FR_DISK_ERR;
+		if (fat) {							/* Reflect the change to all FAT copies */
+			for (nf = 1; nf < fs->n_fats; nf++)
+				disk_write(fs->drv, JrnData[i], sect + fs->fsize * nf, n);
+		}
+	}
+	if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
+		return FR_DISK_ERR;
+	JrnHdr.commit = 0;						/* Uncommitted images are dropped too */
+	JrnHdr.count = 0;
+	return FR_OK;
+}
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) jrn_put (	/* Journal a sector image */
+	FATFS* fs,		/* File system object */
+	const BYTE* buf,/* Sector image */
+	DWORD sect		/* Sector number */
+)
+{
+	UINT i = jrn_find(sect, JrnHdr.count);
+
+
+	if (i == _FS_JOURNAL || i < JrnHdr.commit) {	/* Not in this batch yet */
+		if (JrnHdr.count == _FS_JOURNAL) {	/* Full: the batch is cut here */
+			JrnHdr.commit = JrnHdr.count;
+			if (jrn_apply(fs) != FR_OK) return FR_DISK_ERR;
+		}
+		i = JrnHdr.count;
+		JrnSect[i] = sect;
+		mem_cpy(JrnData[i], buf, SS(fs));
+		JrnHdr.count = i + 1;
+	} else {
+		mem_cpy(JrnData[i], buf, SS(fs));	/* Rewritten within the batch */
+	}
+	return FR_OK;
+}
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) jrn_commit (	/* Commit the batch */
+	FATFS* fs		/* File system object */
+)
+{
+	JrnHdr.commit = JrnHdr.count;			/* The commit point */
+	return (JrnHdr.count > _FS_JOURNAL / 2) ? jrn_apply(fs) : FR_OK;
+}
+
+
+static
+int __attribute__((section(".upper.text"))) jrn_holds (	/* 1:A journaled sector lies in the cluster */
+	FATFS* fs,		/* File system object */
+	DWORD clst		/* Cluster# */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < JrnHdr.count; i++) {	/* An image of a freed directory must not land on new data */
+		if (JrnSect[i] >= fs->database && ((JrnSect[i] - fs->database) >> fs->csize_sh) + 2 == clst)
+			return 1;
+	}
+	return 0;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the file system object               */
 /*-----------------------------------------------------------------------*/
@@ -657,6 +858,14 @@ FRESULT __attribute__((section(".upper.text"))) sync_window (
 
 	if (fs->wflag) {	/* Write back the sector if it is dirty */
 		wsect = fs->winsect;	/* Current sector number */
+#if _FS_JOURNAL
+		if (fs->wflag == 1) {	/* Metadata goes to the journal, file data (2) to the disk */
+			if (jrn_put(fs, fs->win, wsect) != FR_OK)
+				return FR_DISK_ERR;
+			fs->wflag = 0;
+			return FR_OK;
+		}
+#endif
 		if (disk_write(fs->drv, fs->win, wsect, 1))
 			return FR_DISK_ERR;
 		fs->wflag = 0;
@@ -682,6 +891,9 @@ FRESULT __attribute__((section(".upper.text"))) move_window (
 #if !_FS_READONLY
 		if (sync_window(fs) != FR_OK)
 			return FR_DISK_ERR;
+#endif
+#if !_FS_READONLY && _FS_JOURNAL
+		if (!jrn_read(fs, fs->win, sector))	/* The newest image may be journaled */
 #endif
 		if (disk_read(fs->drv, fs->win, sector, 1))
 			return FR_DISK_ERR;
@@ -694,10 +906,96 @@ FRESULT __attribute__((section(".upper.text"))) move_window (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT access - Resident FAT image                                       */
+/*-----------------------------------------------------------------------*/
+/* A volume whose FAT has no more than _FS_FATRES sectors gets the whole  */
+/* primary FAT loaded into FatRes[] at mount. get_fat(), put_fat() and    */
+/* fat_scan() then work on the image without touching the disk or the    */
+/* window. Changed sectors are marked in FatResDirty[] and written to    */
+/* every FAT copy, in runs of consecutive sectors, by fat_flush() at     */
+/* sync time. Larger FATs keep the windowed path.                        */
+#if _FS_FATRES
+#if _FS_FATRES > 256
+#error Wrong _FS_FATRES setting
+#endif
+
+static BYTE FatRes[(DWORD)_FS_FATRES * _MAX_SS] SD_FRAM_BSS;	/* Does not fit below 64K */
+static BYTE FatResDirty[(_FS_FATRES + 7) / 8];	/* One bit per FAT sector */
+static FATFS* FatResFs;		/* Volume owning the image (0:None), cleared when it is unregistered or remounted */
+
+#define FAT_RESIDENT(fs)	(FatResFs == (fs))
+#define FAT_DIRTY(ofs, fs)	(FatResDirty[(ofs) / SS(fs) / 8] |= 1 << ((ofs) / SS(fs) % 8))
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) fat_load (	/* Make the FAT resident if it fits */
+	FATFS* fs		/* File system object being mounted */
+)
+{
+	if (fs->fsize > _FS_FATRES || (FatResFs && FatResFs != fs))
+		return FR_OK;						/* Too large or taken by another mounted volume */
+	FatResFs = 0;
+	if (disk_read(fs->drv, FatRes, fs->fatbase, (UINT)fs->fsize))	/* One multi-block read */
+		return FR_DISK_ERR;
+	mem_set(FatResDirty, 0, sizeof FatResDirty);
+	FatResFs = fs;
+	return FR_OK;
+}
+
+
+#if !_FS_READONLY
+static
+FRESULT __attribute__((section(".upper.text"))) fat_flush (	/* Write back the changed FAT sectors */
+	FATFS* fs		/* File system object */
+)
+{
+	DWORD s, e;
+	UINT nf;
+
+
+	if (!FAT_RESIDENT(fs)) return FR_OK;
+	for (s = 0; s < fs->fsize; s = e) {
+		e = s + 1;
+		if (!(FatResDirty[s / 8] & 1 << (s % 8))) continue;
+		while (e < fs->fsize && (FatResDirty[e / 8] & 1 << (e % 8))) e++;	/* Run of dirty sectors [s, e) */
+#if _FS_JOURNAL
+		for (nf = 0; nf < e - s; nf++) {	/* Goes into the batch being committed */
+			if (jrn_put(fs, FatRes + (s + nf) * SS(fs), fs->fatbase + s + nf) != FR_OK)
+				return FR_DISK_ERR;
+		}
+#else
+		if (disk_write(fs->drv, FatRes + s * SS(fs), fs->fatbase + s, (UINT)(e - s)))
+			return FR_DISK_ERR;
+		for (nf = 1; nf < fs->n_fats; nf++)	/* Reflect the change to all FAT copies */
+			disk_write(fs->drv, FatRes + s * SS(fs), fs->fatbase + fs->fsize * nf + s, (UINT)(e - s));
+#endif
+		for ( ; s < e; s++)
+			FatResDirty[s / 8] &= ~(1 << (s % 8));
+	}
+	return FR_OK;
+}
+#endif
+#else
+#define FAT_RESIDENT(fs)	0
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Synchronize file system and strage device                             */
 /*-----------------------------------------------------------------------*/
 #if !_FS_READONLY
+#if _FS_REENTRANT && _VOLUMES >= 2
+#error FsiBuf[] is shared by all volumes, so sync_fs() cannot run on two volumes at once.
+#endif
+
+/* FSINFO sector image. Building it here rather than in fs->win keeps the  */
+/* FAT or directory sector cached in the window across a sync. The fixed */
+/* part is filled in once, only the two counters change between writes.   */
+static BYTE FsiBuf[_MAX_SS] SD_FRAM_BSS;	/* Written once per sync, so kept out of SRAM */
+
 static
 FRESULT __attribute__((section(".upper.text"))) sync_fs (	/* FR_OK: successful, FR_DISK_ERR: failed */
 	FATFS* fs		/* File system object */
@@ -707,24 +1005,39 @@ FRESULT __attribute__((section(".upper.text"))) sync_fs (	/* FR_OK: successful,
 
 
 	res = sync_window(fs);
+#if _FS_FATRES
+	if (res == FR_OK)
+		res = fat_flush(fs);
+#endif
 	if (res == FR_OK) {
 		/* Update FSINFO sector if needed */
-		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {
+		if (FS_TYPE(fs) == FS_FAT32 && fs->fsi_flag == 1) {
 			/* Create FSINFO structure */
-			mem_set(fs->win, 0, SS(fs));
-			ST_WORD(fs->win+BS_55AA, 0xAA55);
-			ST_DWORD(fs->win+FSI_LeadSig, 0x41615252);
-			ST_DWORD(fs->win+FSI_StrucSig, 0x61417272);
-			ST_DWORD(fs->win+FSI_Free_Count, fs->free_clust);
-			ST_DWORD(fs->win+FSI_Nxt_Free, fs->last_clust);
+			if (LD_WORD(FsiBuf+BS_55AA) != 0xAA55) {
+				mem_set(FsiBuf, 0, SS(fs));
+				ST_WORD(FsiBuf+BS_55AA, 0xAA55);
+				ST_DWORD(FsiBuf+FSI_LeadSig, 0x41615252);
+				ST_DWORD(FsiBuf+FSI_StrucSig, 0x61417272);
+			}
+			ST_DWORD(FsiBuf+FSI_Free_Count, fs->free_clust);
+			ST_DWORD(FsiBuf+FSI_Nxt_Free, fs->last_clust);
 			/* Write it into the FSINFO sector */
-			fs->winsect = fs->volbase + 1;
-			disk_write(fs->drv, fs->win, fs->winsect, 1);
+#if _FS_JOURNAL
+			res = jrn_put(fs, FsiBuf, fs->volbase + 1);
+#else
+			disk_write(fs->drv, FsiBuf, fs->volbase + 1, 1);
+#endif
+			if (fs->winsect == fs->volbase + 1)	/* Keep a window copy loaded at mount current */
+				mem_cpy(fs->win, FsiBuf, SS(fs));
 			fs->fsi_flag = 0;
 		}
 		/* Make sure that no pending write process in the physical drive */
 		if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
 			res = FR_DISK_ERR;
+#if _FS_JOURNAL
+		if (res == FR_OK)
+			res = jrn_commit(fs);	/* The batch takes effect here, after the data */
+#endif
 	}
 
 	return res;
@@ -746,7 +1059,7 @@ DWORD __attribute__((section(".upper.text"))) clust2sect (	/* !=0: Sector number
 {
 	clst -= 2;
 	if (clst >= (fs->n_fatent - 2)) return 0;		/* Invalid cluster# */
-	return clst * fs->csize + fs->database;
+	return (clst << fs->csize_sh) + fs->database;
 }
 
 
@@ -769,7 +1082,22 @@ DWORD __attribute__((section(".upper.text"))) get_fat (	/* 0xFFFFFFFF:Disk error
 	if (clst < 2 || clst >= fs->n_fatent)	/* Check range */
 		return 1;
 
-	switch (fs->fs_type) {
+#if _FS_FATRES
+	if (FAT_RESIDENT(fs)) {
+		switch (FS_TYPE(fs)) {
+		case FS_FAT12 :
+			bc = (UINT)clst; bc += bc / 2;
+			wc = LD_WORD(&FatRes[bc]);
+			return clst & 1 ? wc >> 4 : (wc & 0xFFF);
+		case FS_FAT16 :
+			return LD_WORD(&FatRes[clst * 2]);
+		case FS_FAT32 :
+			return LD_DWORD(&FatRes[clst * 4]) & 0x0FFFFFFF;
+		}
+		return 1;
+	}
+#endif
+	switch (FS_TYPE(fs)) {
 	case FS_FAT12 :
 		bc = (UINT)clst; bc += bc / 2;
 		if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
@@ -817,8 +1145,43 @@ FRESULT __attribute__((section(".upper.text"))) put_fat (
 	if (clst < 2 || clst >= fs->n_fatent) {	/* Check range */
 		res = FR_INT_ERR;
 
+#if _FS_FATRES
+	} else if (FAT_RESIDENT(fs)) {
+		res = FR_OK;
+		switch (FS_TYPE(fs)) {
+		case FS_FAT12 :
+			bc = (UINT)clst; bc += bc / 2;
+			p = &FatRes[bc];
+			if (clst & 1) {
+				p[0] = (p[0] & 0x0F) | ((BYTE)val << 4);
+				p[1] = (BYTE)(val >> 4);
+			} else {
+				p[0] = (BYTE)val;
+				p[1] = (p[1] & 0xF0) | ((BYTE)(val >> 8) & 0x0F);
+			}
+			FAT_DIRTY(bc + 1, fs);			/* The entry may straddle two sectors */
+			FAT_DIRTY(bc, fs);
+			break;
+
+		case FS_FAT16 :
+			ST_WORD(&FatRes[clst * 2], (WORD)val);
+			FAT_DIRTY(clst * 2, fs);
+			break;
+
+		case FS_FAT32 :
+			p = &FatRes[clst * 4];
+			val |= LD_DWORD(p) & 0xF0000000;
+			ST_DWORD(p, val);
+			FAT_DIRTY(clst * 4, fs);
+			break;
+
+		default :
+			res = FR_INT_ERR;
+		}
+
+#endif
 	} else {
-		switch (fs->fs_type) {
+		switch (FS_TYPE(fs)) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
 			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
@@ -861,6 +1224,190 @@ FRESULT __attribute__((section(".upper.text"))) put_fat (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT access - Bulk scan for free entries                               */
+/*-----------------------------------------------------------------------*/
+/* Reads the FAT _FAT_SCAN_SECTS sectors at a time into FatScanBuf[] and  */
+/* tests the entries a word at a time, instead of a move_window() per     */
+/* sector or a get_fat() per cluster. FAT12 is not handled since its      */
+/* entries straddle sector boundaries. Only allocation and f_getfree()   */
+/* scan, so read-only builds leave it out.                                */
+#if !_FS_READONLY && _FAT_SCAN_SECTS
+#if _FAT_SCAN_SECTS > 16
+#error Wrong _FAT_SCAN_SECTS setting
+#endif
+
+static WORD FatScanBuf[_FAT_SCAN_SECTS * _MAX_SS / 2] SD_FRAM_BSS;	/* WORD typed for alignment */
+
+static
+DWORD __attribute__((section(".upper.text"))) fat_scan (	/* Find mode: first free cluster#, 0:None. Count mode: 0. 0xFFFFFFFF:Disk error */
+	FATFS* fs,		/* File system object (FAT16 or FAT32) */
+	DWORD clst,		/* First cluster# to check */
+	DWORD end,		/* Cluster# to stop before (<= fs->n_fatent) */
+	DWORD* nfree	/* Count mode: add the free entries here. NULL: find mode */
+)
+{
+	DWORD sect, nsect, n;
+	UINT epb, shift, i;
+	const WORD *w, *buf;
+
+
+	if (clst >= end) return 0;
+	if (!FAT_RESIDENT(fs) && sync_window(fs) != FR_OK)	/* The window may be newer than the disk */
+		return 0xFFFFFFFF;
+
+	shift = (FS_TYPE(fs) == FS_FAT16) ? 1 : 2;	/* log2(bytes per entry) */
+	epb = SS(fs) >> shift;					/* Entries per sector */
+	sect = fs->fatbase + clst / epb;
+	i = (UINT)(clst % epb);					/* First entry in the first sector */
+
+	while (clst < end) {
+		nsect = fs->fatbase + (end - 1) / epb + 1 - sect;	/* Sectors left to scan */
+#if _FS_FATRES
+		if (FAT_RESIDENT(fs)) {				/* Scan the image in place, all at once */
+			buf = (const WORD*)&FatRes[(sect - fs->fatbase) * SS(fs)];
+		} else
+#endif
+		{
+			if (nsect > _FAT_SCAN_SECTS) nsect = _FAT_SCAN_SECTS;
+			if (disk_read(fs->drv, (BYTE*)FatScanBuf, sect, (UINT)nsect))	/* Multi-block read */
+				return 0xFFFFFFFF;
+#if !_FS_READONLY && _FS_JOURNAL
+			jrn_patch(fs, (BYTE*)FatScanBuf, sect, (UINT)nsect);
+#endif
+			buf = FatScanBuf;
+		}
+		n = nsect * epb - i;				/* Entries in the buffer from i */
+		if (n > end - clst) n = end - clst;
+		w = buf + (i << shift) / 2;
+		if (shift == 1) {					/* FAT16: an entry is a word */
+			for ( ; n; n--, clst++, w++) {
+				if (*w) continue;
+				if (!nfree) return clst;
+				(*nfree)++;
+			}
+		} else {							/* FAT32: low word and 12 bits of the high word */
+			for ( ; n; n--, clst++, w += 2) {
+				if (w[0] || (LD_WORD((const BYTE*)(w + 1)) & 0x0FFF)) continue;
+				if (!nfree) return clst;
+				(*nfree)++;
+			}
+		}
+		sect += nsect;
+		i = 0;
+	}
+
+	return 0;
+}
+#endif /* !_FS_READONLY && _FAT_SCAN_SECTS */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Remove a cluster chain in batched FAT updates          */
+/*-----------------------------------------------------------------------*/
+/* Walks a FAT16/32 chain through FatScanBuf[], which holds a run of up   */
+/* to _FAT_SCAN_SECTS FAT sectors. Entries are zeroed in the buffer and   */
+/* the changed sectors of a run go to every FAT copy in one multi-block   */
+/* write when the chain leaves the run, instead of a get_fat() and        */
+/* put_fat() per cluster and a mirror write per window eviction.          */
+#if !_FS_READONLY && _FAT_SCAN_SECTS && !_USE_ERASE
+static
+FRESULT __attribute__((section(".upper.text"))) put_fat_run (
+	FATFS* fs,		/* File system object */
+	DWORD bsect,	/* Sector# of FatScanBuf[0] */
+	UINT dlo,		/* First dirty sector in the buffer */
+	UINT dhi		/* Last dirty sector in the buffer */
+)
+{
+	const BYTE *buf = (const BYTE*)FatScanBuf + dlo * SS(fs);
+	DWORD wsect = bsect + dlo;
+	UINT cnt = dhi - dlo + 1, nf;
+
+
+#if _FS_JOURNAL
+	for (nf = 0; nf < cnt; nf++) {			/* Journaled one sector at a time, copied home with the batch */
+		if (jrn_put(fs, buf + nf * SS(fs), wsect + nf) != FR_OK)
+			return FR_DISK_ERR;
+	}
+#else
+	if (disk_write(fs->drv, buf, wsect, cnt))
+		return FR_DISK_ERR;
+	for (nf = 1; nf < fs->n_fats; nf++)	/* Reflect the change to all FAT copies */
+		disk_write(fs->drv, buf, wsect + fs->fsize * nf, cnt);
+#endif
+	if (fs->winsect - wsect < cnt)			/* Keep the (clean) window coherent */
+		mem_cpy(fs->win, buf + (fs->winsect - wsect) * SS(fs), SS(fs));
+	return FR_OK;
+}
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) remove_chain_bulk (
+	FATFS* fs,			/* File system object (FAT16 or FAT32) */
+	DWORD clst			/* Cluster# to remove a chain from */
+)
+{
+	FRESULT res;
+	DWORD sect, nxt, bsect = 0, nsect = 0;
+	UINT shift, epb, i, dlo, dhi;
+	BYTE *p;
+
+
+	if (sync_window(fs) != FR_OK)		/* The buffer is filled from the disk */
+		return FR_DISK_ERR;
+
+	shift = (FS_TYPE(fs) == FS_FAT16) ? 1 : 2;	/* log2(bytes per entry) */
+	epb = SS(fs) >> shift;
+	dlo = _FAT_SCAN_SECTS; dhi = 0;		/* No dirty sector in the buffer */
+	res = FR_OK;
+	while (clst < fs->n_fatent) {			/* Not a last link? */
+		sect = fs->fatbase + clst / epb;
+		if (sect - bsect >= nsect) {		/* Entry outside the buffered run? */
+			if (dlo <= dhi) {
+				res = put_fat_run(fs, bsect, dlo, dhi);
+				if (res != FR_OK) break;
+				dlo = _FAT_SCAN_SECTS; dhi = 0;
+			}
+			bsect = sect;
+			nsect = fs->fsize - (sect - fs->fatbase);
+			if (nsect > _FAT_SCAN_SECTS) nsect = _FAT_SCAN_SECTS;
+			if (disk_read(fs->drv, (BYTE*)FatScanBuf, bsect, (UINT)nsect)) {
+				nsect = 0; res = FR_DISK_ERR; break;
+			}
+#if _FS_JOURNAL
+			jrn_patch(fs, (BYTE*)FatScanBuf, bsect, (UINT)nsect);
+#endif
+		}
+		i = (UINT)(sect - bsect);
+		p = (BYTE*)FatScanBuf + i * SS(fs) + ((UINT)(clst % epb) << shift);
+		nxt = (shift == 1) ? LD_WORD(p) : LD_DWORD(p) & 0x0FFFFFFF;	/* Get cluster status */
+		if (nxt == 0) break;				/* Empty cluster? */
+		if (nxt == 1) { res = FR_INT_ERR; break; }	/* Internal error? */
+		if (shift == 1) {					/* Mark the cluster "empty" */
+			ST_WORD(p, 0);
+		} else {
+			ST_DWORD(p, LD_DWORD(p) & 0xF0000000);
+		}
+		if (i < dlo) dlo = i;
+		if (i > dhi) dhi = i;
+		if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSINFO */
+			fs->free_clust++;
+			fs->fsi_flag |= 1;
+		}
+		clst = nxt;	/* Next cluster */
+	}
+	if (dlo <= dhi && put_fat_run(fs, bsect, dlo, dhi) != FR_OK && res == FR_OK)
+		res = FR_DISK_ERR;					/* Entries freed before an error still go out */
+
+	return res;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
 /*-----------------------------------------------------------------------*/
@@ -880,6 +1427,11 @@ FRESULT __attribute__((section(".upper.text"))) remove_chain (
 	if (clst < 2 || clst >= fs->n_fatent) {	/* Check range */
 		res = FR_INT_ERR;
 
+#if _FAT_SCAN_SECTS && !_USE_ERASE
+	} else if (FS_TYPE(fs) != FS_FAT12 && !FAT_RESIDENT(fs)) {	/* Batched FAT updates */
+		res = remove_chain_bulk(fs, clst);
+
+#endif
 	} else {
 		res = FR_OK;
 		while (clst < fs->n_fatent) {			/* Not a last link? */
@@ -918,17 +1470,131 @@ FRESULT __attribute__((section(".upper.text"))) remove_chain (
 /* FAT handling - Stretch or Create a cluster chain                      */
 /*-----------------------------------------------------------------------*/
 #if !_FS_READONLY
+#if _FS_DELALLOC
+static FIL* RsvOwner[_FS_DELALLOC_FILES];	/* Files holding a reserved run */
+
+
 static
-DWORD __attribute__((section(".upper.text"))) create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+DWORD __attribute__((section(".upper.text"))) rsv_end (	/* End of the reserved run holding clst, 0:Not reserved */
 	FATFS* fs,			/* File system object */
-	DWORD clst			/* Cluster# to stretch. 0 means create a new chain. */
+	DWORD clst			/* Cluster# to check */
 )
 {
-	DWORD cs, ncl, scl;
-	FRESULT res;
+	FIL *o;
+	UINT i;
 
 
-	if (clst == 0) {		/* Create a new chain */
+	for (i = 0; i < _FS_DELALLOC_FILES; i++) {
+		o = RsvOwner[i];
+		if (o && o->fs == fs && o->id == fs->id && o->rsv_start
+			&& clst - o->rsv_start < o->rsv_end - o->rsv_start) return o->rsv_end;
+	}
+	return 0;
+}
+#endif
+
+
+static
+DWORD __attribute__((section(".upper.text"))) scan_free (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FATFS* fs,			/* File system object */
+	DWORD scl			/* Search from the cluster after this one */
+)
+{
+	DWORD cs, ncl;
+
+
+#if _FAT_SCAN_SECTS
+	if (FS_TYPE(fs) != FS_FAT12) {
+		ncl = scl + 1;					/* The next cluster is usually free and in the window */
+		if (ncl >= fs->n_fatent) ncl = 2;
+		cs = get_fat(fs, ncl);
+		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
+			return cs;
+		if (cs != 0) {					/* Bulk search to the end of the FAT, then wrap around */
+			ncl = fat_scan(fs, ncl + 1, fs->n_fatent, 0);
+			if (ncl == 0)
+				ncl = fat_scan(fs, 2, (scl < fs->n_fatent) ? scl + 1 : fs->n_fatent, 0);
+			if (ncl == 0 || ncl == 0xFFFFFFFF)	/* No free cluster or disk error */
+				return ncl;
+		}
+	} else
+#endif
+	{
+		ncl = scl;				/* Start cluster */
+		for (;;) {
+			ncl++;							/* Next cluster */
+			if (ncl >= fs->n_fatent) {		/* Check wrap around */
+				ncl = 2;
+				if (ncl > scl) return 0;	/* No free cluster */
+			}
+			cs = get_fat(fs, ncl);			/* Get the cluster status */
+			if (cs == 0) break;				/* Found a free cluster */
+			if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
+				return cs;
+			if (ncl == scl) return 0;		/* No free cluster */
+		}
+	}
+	return ncl;
+}
+
+
+#if _FS_DELALLOC || _FS_JOURNAL
+static
+DWORD __attribute__((section(".upper.text"))) busy_end (	/* Cluster# after a busy run holding clst, 0:Free to take */
+	FATFS* fs,			/* File system object */
+	DWORD clst			/* Cluster# free on the FAT */
+)
+{
+#if _FS_DELALLOC
+	DWORD e = rsv_end(fs, clst);
+
+
+	if (e) return e;						/* Reserved by an open file */
+#endif
+#if _FS_JOURNAL
+	if (jrn_holds(fs, clst)) return clst + 1;	/* Still has a journaled image */
+#endif
+	return 0;
+}
+#endif
+
+
+static
+DWORD __attribute__((section(".upper.text"))) find_free (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FATFS* fs,			/* File system object */
+	DWORD scl			/* Search from the cluster after this one */
+)
+{
+#if _FS_DELALLOC || _FS_JOURNAL
+	DWORD ncl, e;
+	UINT n;
+
+
+	for (n = 0; n <= 2 * _FS_DELALLOC_FILES + _FS_JOURNAL; n++) {	/* Step over clusters free on the FAT but busy */
+		ncl = scan_free(fs, scl);
+		if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+		e = busy_end(fs, ncl);
+		if (!e) return ncl;
+		scl = e - 1;
+	}
+	return 0;				/* Only busy clusters are left */
+#else
+	return scan_free(fs, scl);
+#endif
+}
+
+
+static
+DWORD __attribute__((section(".upper.text"))) create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FATFS* fs,			/* File system object */
+	DWORD clst			/* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+	DWORD cs, ncl, scl;
+	FRESULT res;
+
+
+	if (clst == 0) {		/* Create a new chain */
 		scl = fs->last_clust;			/* Get suggested start point */
 		if (!scl || scl >= fs->n_fatent) scl = 1;
 	}
@@ -940,19 +1606,8 @@ DWORD __attribute__((section(".upper.text"))) create_chain (	/* 0:No free cluste
 		scl = clst;
 	}
 
-	ncl = scl;				/* Start cluster */
-	for (;;) {
-		ncl++;							/* Next cluster */
-		if (ncl >= fs->n_fatent) {		/* Check wrap around */
-			ncl = 2;
-			if (ncl > scl) return 0;	/* No free cluster */
-		}
-		cs = get_fat(fs, ncl);			/* Get the cluster status */
-		if (cs == 0) break;				/* Found a free cluster */
-		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
-			return cs;
-		if (ncl == scl) return 0;		/* No free cluster */
-	}
+	ncl = find_free(fs, scl);			/* Find a free cluster */
+	if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
 
 	res = put_fat(fs, ncl, 0x0FFFFFFF);	/* Mark the new cluster "last link" */
 	if (res == FR_OK && clst != 0) {
@@ -990,7 +1645,7 @@ DWORD __attribute__((section(".upper.text"))) clmt_clust (	/* <2:Error, >=2:Clus
 
 
 	tbl = fp->cltbl + 1;	/* Top of CLMT */
-	cl = ofs / SS(fp->fs) / fp->fs->csize;	/* Cluster order from top of the file */
+	cl = ofs / SS(fp->fs) >> fp->fs->csize_sh;	/* Cluster order from top of the file */
 	for (;;) {
 		ncl = *tbl++;			/* Number of cluters in the fragment */
 		if (!ncl) return 0;		/* End of table? (error) */
@@ -1004,6 +1659,46 @@ DWORD __attribute__((section(".upper.text"))) clmt_clust (	/* <2:Error, >=2:Clus
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Fill a cluster with zeros                        */
+/*-----------------------------------------------------------------------*/
+/* The zeros go out as one multiple block write through CTRL_ZERO_SECTORS */
+/* when the driver has it, or one sector at a time otherwise. The window  */
+/* is left on the first sector of the cluster, cleared.                   */
+#if !_FS_READONLY
+static
+FRESULT __attribute__((section(".upper.text"))) dir_clear (
+	FATFS* fs,		/* File system object */
+	DWORD clst		/* Cluster# to clear */
+)
+{
+	DWORD sect, rt[2];
+	DRESULT dr;
+	UINT n;
+
+
+	if (sync_window(fs)) return FR_DISK_ERR;	/* Flush disk access window */
+	sect = clust2sect(fs, clst);
+	if (!sect) return FR_INT_ERR;
+	mem_set(fs->win, 0, SS(fs));				/* Clear window buffer */
+	fs->winsect = sect;
+
+	rt[0] = sect; rt[1] = fs->csize;
+	dr = disk_ioctl(fs->drv, CTRL_ZERO_SECTORS, rt);
+	if (dr == RES_PARERR) {						/* Not supported by the driver */
+		for (n = 0; n < fs->csize; n++) {
+			if (disk_write(fs->drv, fs->win, sect + n, 1)) return FR_DISK_ERR;
+		}
+	} else if (dr != RES_OK) {
+		return FR_DISK_ERR;
+	}
+	return FR_OK;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Set directory index                              */
 /*-----------------------------------------------------------------------*/
@@ -1022,16 +1717,16 @@ FRESULT __attribute__((section(".upper.text"))) dir_sdi (
 	clst = dp->sclust;		/* Table start cluster (0:root) */
 	if (clst == 1 || clst >= dp->fs->n_fatent)	/* Check start cluster range */
 		return FR_INT_ERR;
-	if (!clst && dp->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
+	if (!clst && FS_TYPE(dp->fs) == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
 		clst = dp->fs->dirbase;
 
-	if (clst == 0) {	/* Static table (root-directory in FAT12/16) */
+	if (!_FS_FAT32_ONLY && clst == 0) {	/* Static table (root-directory in FAT12/16) */
 		if (idx >= dp->fs->n_rootdir)	/* Is index out of range? */
 			return FR_INT_ERR;
 		sect = dp->fs->dirbase;
 	}
 	else {				/* Dynamic table (root-directory in FAT32 or sub-directory) */
-		ic = SS(dp->fs) / SZ_DIR * dp->fs->csize;	/* Entries per cluster */
+		ic = (UINT)(SS(dp->fs) / SZ_DIR) << dp->fs->csize_sh;	/* Entries per cluster */
 		while (idx >= ic) {	/* Follow cluster chain */
 			clst = get_fat(dp->fs, clst);				/* Get next cluster */
 			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error */
@@ -1073,7 +1768,7 @@ FRESULT __attribute__((section(".upper.text"))) dir_next (	/* FR_OK:Succeeded, F
 	if (!(i % (SS(dp->fs) / SZ_DIR))) {	/* Sector changed? */
 		dp->sect++;					/* Next sector */
 
-		if (!dp->clust) {		/* Static table */
+		if (!_FS_FAT32_ONLY && !dp->clust) {	/* Static table */
 			if (i >= dp->fs->n_rootdir)	/* Report EOT if it reached end of static table */
 				return FR_NO_FILE;
 		}
@@ -1084,22 +1779,12 @@ FRESULT __attribute__((section(".upper.text"))) dir_next (	/* FR_OK:Succeeded, F
 				if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
 				if (clst >= dp->fs->n_fatent) {					/* If it reached end of dynamic table, */
 #if !_FS_READONLY
-					UINT c;
 					if (!stretch) return FR_NO_FILE;			/* If do not stretch, report EOT */
 					clst = create_chain(dp->fs, dp->clust);		/* Stretch cluster chain */
 					if (clst == 0) return FR_DENIED;			/* No free cluster */
 					if (clst == 1) return FR_INT_ERR;
 					if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
-					/* Clean-up stretched table */
-					if (sync_window(dp->fs)) return FR_DISK_ERR;/* Flush disk access window */
-					mem_set(dp->fs->win, 0, SS(dp->fs));		/* Clear window buffer */
-					dp->fs->winsect = clust2sect(dp->fs, clst);	/* Cluster start sector */
-					for (c = 0; c < dp->fs->csize; c++) {		/* Fill the new cluster with 0 */
-						dp->fs->wflag = 1;
-						if (sync_window(dp->fs)) return FR_DISK_ERR;
-						dp->fs->winsect++;
-					}
-					dp->fs->winsect -= c;						/* Rewind window offset */
+					if (dir_clear(dp->fs, clst)) return FR_DISK_ERR;	/* Clean-up stretched table */
 #else
 					if (!stretch) return FR_NO_FILE;			/* If do not stretch, report EOT (this is to suppress warning) */
 					return FR_NO_FILE;							/* Report EOT */
@@ -1170,7 +1855,7 @@ DWORD __attribute__((section(".upper.text"))) ld_clust (
 	DWORD cl;
 
 	cl = LD_WORD(dir+DIR_FstClusLO);
-	if (fs->fs_type == FS_FAT32)
+	if (FS_TYPE(fs) == FS_FAT32)
 		cl |= (DWORD)LD_WORD(dir+DIR_FstClusHI) << 16;
 
 	return cl;
@@ -1497,6 +2182,49 @@ FRESULT __attribute__((section(".upper.text"))) dir_read (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Forget f_opennum() numbers a new name may have taken                  */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY && _USE_NUMNAME
+#if _USE_NUMNAME > 8
+#error Wrong _USE_NUMNAME setting
+#endif
+
+typedef struct {
+	FATFS*	fs;			/* File system object (0:Unused) */
+	WORD	id;			/* Mount ID of the file system */
+	WORD	index;		/* Directory index likely to be free */
+	DWORD	sclust;		/* Directory start cluster */
+	DWORD	next;		/* Next number to give out */
+	BYTE	pat[11];	/* Name pattern in SFN format */
+} NUMNAME;
+
+static NUMNAME NumName[_USE_NUMNAME];
+static BYTE NumNext;
+
+
+static
+void __attribute__((section(".upper.text"))) numname_drop (
+	DIR* dp				/* Directory and SFN (dp->fn) being created */
+)
+{
+	NUMNAME *nn;
+	UINT i;
+
+
+	for (nn = NumName; nn < NumName + _USE_NUMNAME; nn++) {
+		if (nn->fs != dp->fs || nn->sclust != dp->sclust) continue;
+		for (i = 0; i < 11; i++) {
+			if (nn->pat[i] == '#' ? !IsDigit(dp->fn[i]) : nn->pat[i] != dp->fn[i]) break;
+		}
+		if (i == 11) nn->fs = 0;		/* The cached number may be taken now */
+	}
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
 /*-----------------------------------------------------------------------*/
@@ -1565,6 +2293,9 @@ FRESULT __attribute__((section(".upper.text"))) dir_register (	/* FR_OK:Successf
 			dp->dir[DIR_NTres] = dp->fn[NS] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			dp->fs->wflag = 1;
+#if _USE_NUMNAME
+			numname_drop(dp);
+#endif
 		}
 	}
 
@@ -1575,6 +2306,141 @@ FRESULT __attribute__((section(".upper.text"))) dir_register (	/* FR_OK:Successf
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Path cache                                                            */
+/*-----------------------------------------------------------------------*/
+/* follow_path() remembers where the entries of the last _FS_PATHCACHE    */
+/* paths it resolved are, so following one of them again loads a single  */
+/* directory sector instead of searching every directory on the way. A   */
+/* hit is taken only while the entry still holds the same SFN. Removing  */
+/* any entry drops the volume's paths, since a removed or renamed        */
+/* directory takes the paths below it along, and a remount drops all.    */
+/* Objects with an LFN are not cached, as f_stat() needs the LFN text.   */
+#if _FS_PATHCACHE
+#if _FS_PATHCACHE > 16
+#error Wrong _FS_PATHCACHE setting
+#endif
+#define PC_MAXPATH	32		/* Longest path cached, in TCHARs with the terminator */
+
+typedef struct {
+	FATFS*	fs;			/* File system object (0:Unused) */
+	WORD	id;			/* Mount ID of the file system */
+	WORD	index;		/* Index of the entry in its directory */
+	DWORD	start;		/* Directory the path is followed from */
+	DWORD	sclust;		/* Directory holding the entry */
+	DWORD	clust;		/* Cluster holding the entry */
+	DWORD	sect;		/* Sector holding the entry */
+	DWORD	use;		/* Stamp of the last use */
+	BYTE	fn[12];		/* SFN of the entry and name status */
+	TCHAR	path[PC_MAXPATH];	/* Path followed */
+} PATHENT;
+
+static PATHENT PathEnt[_FS_PATHCACHE];
+static DWORD PathTick;
+
+
+static
+PATHENT* __attribute__((section(".upper.text"))) path_slot (	/* Cached path, 0:None */
+	DIR* dp,			/* Directory object with fs and the start directory set */
+	const TCHAR* path	/* Path to follow from the start directory */
+)
+{
+	PATHENT *pe;
+	UINT i;
+
+
+	for (pe = PathEnt; pe < PathEnt + _FS_PATHCACHE; pe++) {
+		if (pe->fs != dp->fs || pe->id != dp->fs->id || pe->start != dp->sclust) continue;
+		for (i = 0; pe->path[i] == path[i] && path[i]; i++) ;
+		if (pe->path[i] == path[i]) return pe;
+	}
+	return 0;
+}
+
+
+static
+int __attribute__((section(".upper.text"))) path_find (	/* 1:Entry loaded from the cache, 0:Not cached */
+	DIR* dp,			/* Directory object with fs and the start directory set */
+	const TCHAR* path	/* Path to follow from the start directory */
+)
+{
+	PATHENT *pe = path_slot(dp, path);
+	BYTE *dir;
+
+
+	if (!pe || move_window(dp->fs, pe->sect) != FR_OK) return 0;	/* The full walk reports errors */
+	dir = dp->fs->win + (pe->index % (SS(dp->fs) / SZ_DIR)) * SZ_DIR;
+	if (mem_cmp(dir, pe->fn, 11)) {		/* Deleted or renamed since */
+		pe->fs = 0;
+		return 0;
+	}
+	dp->sclust = pe->sclust;
+	dp->clust = pe->clust;
+	dp->sect = pe->sect;
+	dp->index = pe->index;
+	dp->dir = dir;
+	mem_cpy(dp->fn, pe->fn, 12);
+#if _USE_LFN
+	dp->lfn_idx = 0xFFFF;
+#endif
+	pe->use = ++PathTick;
+	return 1;
+}
+
+
+static
+void __attribute__((section(".upper.text"))) path_note (
+	DIR* dp,			/* Directory object pointing the entry found */
+	DWORD start,		/* Directory the path was followed from */
+	const TCHAR* path	/* Path followed */
+)
+{
+	PATHENT *pe, *v;
+	UINT i;
+
+
+	for (i = 0; path[i]; i++) {
+		if (i == PC_MAXPATH - 1) return;	/* Too long to cache */
+	}
+#if _USE_LFN
+	if (dp->lfn_idx != 0xFFFF) return;
+#endif
+	for (pe = v = PathEnt; pe < PathEnt + _FS_PATHCACHE; pe++) {	/* Free or stale slot, or least recently used */
+		if (!pe->fs || (pe->fs == dp->fs && pe->id != dp->fs->id)) { v = pe; break; }	/* Never read through another volume's pointer */
+		if (pe->use < v->use) v = pe;
+	}
+	v->fs = dp->fs;
+	v->id = dp->fs->id;
+	v->index = dp->index;
+	v->start = start;
+	v->sclust = dp->sclust;
+	v->clust = dp->clust;
+	v->sect = dp->sect;
+	v->use = ++PathTick;
+	mem_cpy(v->fn, dp->fn, 12);
+	mem_cpy(v->path, path, (i + 1) * sizeof (TCHAR));
+}
+
+
+#if !_FS_READONLY
+static
+void __attribute__((section(".upper.text"))) path_drop (	/* Forget the cached paths of a volume */
+	FATFS* fs			/* File system object */
+)
+{
+	PATHENT *pe;
+
+
+	for (pe = PathEnt; pe < PathEnt + _FS_PATHCACHE; pe++) {
+		if (pe->fs == fs) pe->fs = 0;
+	}
+}
+#endif
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Remove an object from the directory                                   */
 /*-----------------------------------------------------------------------*/
@@ -1587,7 +2453,12 @@ FRESULT dir_remove (	/* FR_OK: Successful, FR_DISK_ERR: A disk error */
 	FRESULT res;
 #if _USE_LFN	/* LFN configuration */
 	UINT i;
+#endif
 
+#if _FS_PATHCACHE
+	path_drop(dp->fs);	/* Paths through a removed directory go too */
+#endif
+#if _USE_LFN
 	i = dp->index;	/* SFN index */
 	res = dir_sdi(dp, (dp->lfn_idx == 0xFFFF) ? i : dp->lfn_idx);	/* Goto the SFN or top of the LFN entries */
 	if (res == FR_OK) {
@@ -1914,6 +2785,10 @@ FRESULT __attribute__((section(".upper.text"))) follow_path (	/* FR_OK(0): succe
 {
 	FRESULT res;
 	BYTE *dir, ns;
+#if _FS_PATHCACHE
+	DWORD start;
+	const TCHAR *top;
+#endif
 
 
 #if _FS_RPATH
@@ -1927,6 +2802,10 @@ FRESULT __attribute__((section(".upper.text"))) follow_path (	/* FR_OK(0): succe
 		path++;
 	dp->sclust = 0;							/* Always start from the root directory */
 #endif
+#if _FS_PATHCACHE
+	if (path_find(dp, path)) return FR_OK;	/* Followed before */
+	start = dp->sclust; top = path;
+#endif
 
 	if ((UINT)*path < ' ') {				/* Null path name is the origin directory itself */
 		res = dir_sdi(dp, 0);
@@ -1957,6 +2836,9 @@ FRESULT __attribute__((section(".upper.text"))) follow_path (	/* FR_OK(0): succe
 			dp->sclust = ld_clust(dp->fs, dir);
 		}
 	}
+#if _FS_PATHCACHE
+	if (res == FR_OK && dp->dir) path_note(dp, start, top);
+#endif
 
 	return res;
 }
@@ -2051,6 +2933,109 @@ BYTE __attribute__((section(".upper.text"))) check_fs (	/* 0:FAT boor sector, 1:
 
 
 
+/*-----------------------------------------------------------------------*/
+/* File tail hints                                                       */
+/*-----------------------------------------------------------------------*/
+/* A hint names the last cluster of a file, keyed by the location of its  */
+/* directory entry. It is taken only while the start cluster and size in */
+/* the entry still match and the FAT still ends a chain at it. The hints  */
+/* belong to one volume, named by its start sector, VSN and the card's    */
+/* CID: mounting another volume or f_mkfs() drops them all.               */
+#if !_FS_READONLY && _FS_TAIL_HINTS
+typedef struct {
+	DWORD	dir_sect;	/* Sector holding the directory entry (0:Unused) */
+	WORD	dir_ofs;	/* Offset of the entry in the sector */
+	BYTE	drv;		/* Physical drive number */
+	DWORD	sclust;		/* File start cluster */
+	DWORD	fsize;		/* File size */
+	DWORD	tail;		/* Last cluster of the chain */
+} TAILHINT;
+
+typedef struct {
+	DWORD	vol;		/* Start sector of the volume the hints belong to */
+	DWORD	vsn;		/* Its volume serial number */
+	BYTE	cid[16];	/* CID of the card holding it (0s:Not reported) */
+} TAILVOL;
+
+#ifdef __MSP430__		/* Kept over power cycles, like the FRAM sector cache */
+static TAILHINT TailHint[_FS_TAIL_HINTS] __attribute__((persistent)) = {{0}};
+static BYTE TailNext __attribute__((persistent)) = 0;
+static TAILVOL TailVol __attribute__((persistent)) = {0};
+#else
+static TAILHINT TailHint[_FS_TAIL_HINTS];
+static BYTE TailNext;
+static TAILVOL TailVol;
+#endif
+
+
+static
+void __attribute__((section(".upper.text"))) tail_bind (	/* Drop the hints unless they belong to this volume */
+	BYTE drv,			/* Physical drive number */
+	DWORD vol,			/* Start sector of the volume, 0xFFFFFFFF:Drop unconditionally */
+	DWORD vsn			/* Volume serial number */
+)
+{
+	BYTE cid[16];
+
+
+	if (disk_ioctl(drv, MMC_GET_CID, cid) != RES_OK) mem_set(cid, 0, sizeof cid);
+	if (vol != 0xFFFFFFFF && TailVol.vol == vol && TailVol.vsn == vsn && !mem_cmp(TailVol.cid, cid, sizeof cid))
+		return;
+	mem_set(TailHint, 0, sizeof TailHint);
+	TailNext = 0;
+	TailVol.vol = vol; TailVol.vsn = vsn;
+	mem_cpy(TailVol.cid, cid, sizeof cid);
+}
+
+
+static
+TAILHINT* __attribute__((section(".upper.text"))) tail_find (	/* Hint slot of a file, 0:None */
+	FIL* fp,			/* File object with dir_sect and dir_ptr set */
+	FATFS* fs			/* File system object of the file */
+)
+{
+	TAILHINT *h;
+	WORD ofs = (WORD)(fp->dir_ptr - fs->win);
+
+
+	for (h = TailHint; h < TailHint + _FS_TAIL_HINTS; h++) {
+		if (h->dir_sect == fp->dir_sect && h->dir_ofs == ofs && h->drv == fs->drv)
+			return h;
+	}
+	return 0;
+}
+
+
+static
+void __attribute__((section(".upper.text"))) tail_note (
+	FIL* fp,			/* File object */
+	FATFS* fs,			/* File system object of the file */
+	DWORD tail			/* Last cluster of the file, 0:Drop the hint */
+)
+{
+	TAILHINT *h;
+
+
+	h = tail_find(fp, fs);
+	if (!h) {
+		if (!tail) return;
+		h = &TailHint[TailNext];		/* Replace the hints in turn */
+		TailNext = (BYTE)((TailNext + 1) % _FS_TAIL_HINTS);
+	}
+	h->dir_sect = 0;					/* Invalid until all fields are in */
+	if (!tail) return;
+	h->dir_ofs = (WORD)(fp->dir_ptr - fs->win);
+	h->drv = fs->drv;
+	h->sclust = fp->sclust;
+	h->fsize = fp->fsize;
+	h->tail = tail;
+	h->dir_sect = fp->dir_sect;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Find logical drive and check if the volume is mounted                 */
 /*-----------------------------------------------------------------------*/
@@ -2067,6 +3052,9 @@ static FRESULT __attribute__((section(".upper.text"))) find_volume (	/* FR_OK(0)
 	int vol;
 	DSTATUS stat;
 	DWORD bsect, fasize, tsect, sysect, nclst, szbfat;
+#if !_FS_READONLY && (_FS_JOURNAL || _FS_TAIL_HINTS)
+	DWORD vsn;
+#endif
 	WORD nrsv;
 	FATFS *fs;
 
@@ -2096,6 +3084,9 @@ static FRESULT __attribute__((section(".upper.text"))) find_volume (	/* FR_OK(0)
 	/* Following code attempts to mount the volume. (analyze BPB and initialize the fs object) */
 
 	fs->fs_type = 0;					/* Clear the file system object */
+#if _FS_FATRES
+	if (FAT_RESIDENT(fs)) FatResFs = 0;	/* The image is reloaded below */
+#endif
 	fs->drv = LD2PD(vol);				/* Bind the logical drive and a physical drive */
 	stat = disk_initialize(fs->drv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT)				/* Check if the initialization succeeded */
@@ -2144,6 +3135,7 @@ static FRESULT __attribute__((section(".upper.text"))) find_volume (	/* FR_OK(0)
 	fs->csize = fs->win[BPB_SecPerClus];				/* Number of sectors per cluster */
 	if (!fs->csize || (fs->csize & (fs->csize - 1)))	/* (Must be power of 2) */
 		return FR_NO_FILESYSTEM;
+	for (fs->csize_sh = 0; (1 << fs->csize_sh) < fs->csize; fs->csize_sh++) ;	/* log2(csize) */
 
 	fs->n_rootdir = LD_WORD(fs->win+BPB_RootEntCnt);	/* Number of root directory entries */
 	if (fs->n_rootdir % (SS(fs) / SZ_DIR))				/* (Must be sector aligned) */
@@ -2158,11 +3150,13 @@ static FRESULT __attribute__((section(".upper.text"))) find_volume (	/* FR_OK(0)
 	/* Determine the FAT sub type */
 	sysect = nrsv + fasize + fs->n_rootdir / (SS(fs) / SZ_DIR);	/* RSV+FAT+DIR */
 	if (tsect < sysect) return FR_NO_FILESYSTEM;		/* (Invalid volume size) */
-	nclst = (tsect - sysect) / fs->csize;				/* Number of clusters */
+	nclst = (tsect - sysect) >> fs->csize_sh;			/* Number of clusters */
 	if (!nclst) return FR_NO_FILESYSTEM;				/* (Invalid volume size) */
 	fmt = FS_FAT12;
 	if (nclst >= MIN_FAT16) fmt = FS_FAT16;
 	if (nclst >= MIN_FAT32) fmt = FS_FAT32;
+	if (_FS_FAT32_ONLY && fmt != FS_FAT32)				/* (FAT12/16 support is not built in) */
+		return FR_NO_FILESYSTEM;
 
 	/* Boundaries and Limits */
 	fs->n_fatent = nclst + 2;							/* Number of FAT entries */
@@ -2182,6 +3176,25 @@ static FRESULT __attribute__((section(".upper.text"))) find_volume (	/* FR_OK(0)
 	if (fs->fsize < (szbfat + (SS(fs) - 1)) / SS(fs))	/* (BPB_FATSz must not be less than needed) */
 		return FR_NO_FILESYSTEM;
 
+#if !_FS_READONLY && (_FS_JOURNAL || _FS_TAIL_HINTS)
+	vsn = LD_DWORD(fs->win + (fmt == FS_FAT32 ? BS_VolID32 : BS_VolID));
+#endif
+#if !_FS_READONLY && _FS_TAIL_HINTS
+	tail_bind(fs->drv, bsect, vsn);		/* Hints left by another volume or card are void */
+#endif
+#if !_FS_READONLY && _FS_JOURNAL
+	/* Replay the batches committed before a power loss */
+	if (JrnHdr.vol != bsect || JrnHdr.vsn != vsn) {	/* Left by another volume */
+		JrnHdr.commit = JrnHdr.count = 0;
+		JrnHdr.vol = bsect; JrnHdr.vsn = vsn;
+	}
+	if (JrnHdr.count && jrn_apply(fs) != FR_OK)
+		return FR_DISK_ERR;
+#endif
+#if _FS_FATRES
+	if (fat_load(fs) != FR_OK)			/* After the replay, so the image is current */
+		return FR_DISK_ERR;
+#endif
 #if !_FS_READONLY
 	/* Initialize cluster allocation information */
 	fs->last_clust = fs->free_clust = 0xFFFFFFFF;
@@ -2284,6 +3297,13 @@ FRESULT __attribute__((section(".upper.text"))) f_mount (
 		if (!ff_del_syncobj(cfs->sobj)) {
       return FR_INT_ERR;
     }
+#endif
+#if !_FS_READONLY && _FS_JOURNAL
+		if (cfs->fs_type && JrnHdr.count)	/* Copy the committed batches home */
+			jrn_apply(cfs);
+#endif
+#if _FS_FATRES
+		if (FAT_RESIDENT(cfs)) FatResFs = 0;	/* Unsynced FAT changes are dropped like the window */
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
 	}
@@ -2308,35 +3328,482 @@ FRESULT __attribute__((section(".upper.text"))) f_mount (
 
 
 /*-----------------------------------------------------------------------*/
-/* Open or Create a File                                                 */
+/* Move the File Pointer to the End of the File                          */
 /*-----------------------------------------------------------------------*/
-
-//FRESULT __attribute__ ((section (".upper.text"))) f_open (
-FRESULT __attribute__((section(".upper.text"))) f_open (
-	FIL* fp,			/* Pointer to the blank file object */
-	const TCHAR* path,	/* Pointer to the file name */
-	BYTE mode			/* Access mode and file open mode flags */
+/* Used by f_open() for FA_OPEN_APPEND. A valid tail hint avoids walking  */
+/* the cluster chain from the top of the file.                            */
+#if !_FS_READONLY
+static
+FRESULT __attribute__((section(".upper.text"))) seek_tail (
+	FIL* fp,			/* File object being opened (fsize > 0) */
+	FATFS* fs			/* File system object of the file */
 )
 {
-	FRESULT res;
-	DIR dj;
-	BYTE *dir;
-	DEF_NAMEBUF;
+	DWORD clst, ncl, sect;
+#if _FS_TAIL_HINTS
+	TAILHINT *h;
+#endif
 
 
-	if (!fp) 
-    return FR_INVALID_OBJECT;
-	fp->fs = 0;			/* Clear file object */
+	ncl = (fp->fsize - 1) / SS(fs) >> fs->csize_sh;	/* Clusters before the last one */
+	clst = 0;
+#if _FS_TAIL_HINTS
+	h = tail_find(fp, fs);
+	if (h && h->sclust == fp->sclust && h->fsize == fp->fsize && (ncl || h->tail == fp->sclust)) {
+		sect = get_fat(fs, h->tail);
+		if (sect == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (sect >= fs->n_fatent) clst = h->tail;	/* Still the end of a chain */
+	}
+#endif
+	if (!clst) {						/* Follow the chain */
+		clst = fp->sclust;
+		while (ncl--) {
+			clst = get_fat(fs, clst);
+			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
+			if (clst <= 1 || clst >= fs->n_fatent) return FR_INT_ERR;
+		}
+#if _FS_TAIL_HINTS
+		tail_note(fp, fs, clst);
+#endif
+	}
 
-	/* Get logical drive number */
-#if !_FS_READONLY
-	mode &= FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW;
-	res = find_volume(&dj.fs, &path, (BYTE)(mode & ~FA_READ));
-#else
-	mode &= FA_READ;
-	res = find_volume(&dj.fs, &path, 0);
+	fp->clust = clst;
+	fp->fptr = fp->fsize;
+	if (fp->fptr % SS(fs)) {			/* Fill sector cache for a partial sector */
+		sect = clust2sect(fs, clst);
+		if (!sect) return FR_INT_ERR;
+		sect += (fp->fptr - 1) / SS(fs) & (fs->csize - 1);
+#if !_FS_TINY
+		if (disk_read(fs->drv, fp->buf, sect, 1))
+			return FR_DISK_ERR;
 #endif
-	if (res == FR_OK) {
+		fp->dsect = sect;
+	}
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* File sector cache - Write back and fill                               */
+/*-----------------------------------------------------------------------*/
+/* Without a multi-sector buffer a dirty buf[] goes straight to the disk. */
+/* A file holding one from the _FS_MBUF pool stages it in mbuf[] behind   */
+/* the sectors it follows, and the run goes out as one multi-block write  */
+/* when it is full, when a sector that does not follow it is staged, or   */
+/* on f_sync(). Staged sectors are newer than the disk, so fills and      */
+/* direct reads take them from mbuf[].                                    */
+/* In the tiny configuration with _FS_DATABUFS, buf[] is a sector buffer  */
+/* lent from a shared pool. fbuf_get() lends one on entry to f_read() and */
+/* f_write(), taking the least recently used one from another file when  */
+/* none is free. Between calls, fbuf_rest() unpins a buffer holding no    */
+/* unwritten data, so it can be taken without touching the file that had  */
+/* it; that file notices on its next call and reloads. Only a pinned      */
+/* buffer costs its file a write-back of the dirty sector.                */
+#if !_FS_DATAWIN
+#if _FS_TINY && _FS_DATABUFS
+static BYTE DataBuf[_FS_DATABUFS][_MAX_SS] SD_SRAM_BSS;	/* On the per-sector path */
+static FIL* DataOwner[_FS_DATABUFS];
+static BYTE DataPin[_FS_DATABUFS];		/* The owner is in a call or holds unwritten data */
+static DWORD DataUse[_FS_DATABUFS];		/* Stamp of the last use of each buffer */
+static DWORD DataTick;
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) fbuf_get (	/* Lend buf[] to a file */
+	FIL* fp,		/* File about to use buf[] */
+	int load		/* 1:Reload the sector it was on */
+)
+{
+	FIL *o;
+	UINT i, v;
+
+
+	for (i = 0; i < _FS_DATABUFS && fp->buf != DataBuf[i]; i++) ;
+	if (i == _FS_DATABUFS || DataOwner[i] != fp) {	/* Not holding one */
+		for (v = i = 0; i < _FS_DATABUFS; i++) {
+			o = DataOwner[i];
+			if (!o || (DataPin[i] && (!o->fs || o->id != o->fs->id || o->buf != DataBuf[i]))) {	/* Free, closed or stale */
+				v = i;
+				break;
+			}
+			if (DataUse[i] < DataUse[v]) v = i;	/* Least recently used */
+		}
+		o = DataOwner[v];
+		if (i == _FS_DATABUFS && DataPin[v]) {	/* The owner is only dereferenced while pinned */
+#if !_FS_READONLY
+			if (o->flag & FA__DIRTY) {		/* Write back the sector of the file losing it */
+				if (disk_write(o->fs->drv, o->buf, o->dsect, 1))
+					return FR_DISK_ERR;
+				o->flag &= ~FA__DIRTY;
+			}
+#endif
+			o->buf = 0;
+		}
+		DataOwner[v] = fp;
+		fp->buf = DataBuf[v];
+		if (load && fp->dsect && (fp->fptr % SS(fp->fs))) {	/* Mid-sector: reload it */
+			if (disk_read(fp->fs->drv, fp->buf, fp->dsect, 1))
+				return FR_DISK_ERR;
+		} else {
+			fp->dsect = 0;					/* Reloaded on the sector boundary */
+		}
+		i = v;
+	}
+	DataPin[i] = 1;
+	DataUse[i] = ++DataTick;
+	return FR_OK;
+}
+
+
+static
+void __attribute__((section(".upper.text"))) fbuf_rest (	/* Unpin buf[] on the way out of a call */
+	FIL* fp
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DATABUFS; i++) {
+		if (DataOwner[i] == fp && fp->buf == DataBuf[i])
+#if !_FS_READONLY
+			DataPin[i] = (fp->flag & FA__DIRTY) ? 1 : 0;
+#else
+			DataPin[i] = 0;
+#endif
+	}
+}
+
+
+static
+void __attribute__((section(".upper.text"))) fbuf_put (	/* Return buf[] to the pool */
+	FIL* fp			/* File being closed */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DATABUFS; i++) {
+		if (DataOwner[i] == fp) {
+			DataOwner[i] = 0;
+			DataPin[i] = 0;
+		}
+	}
+	fp->buf = 0;
+}
+#endif
+
+#if !_FS_TINY && !_FS_READONLY && _FS_MBUF
+#if _FS_MBUF_SECTS < 2 || _FS_MBUF_SECTS > 128
+#error Wrong _FS_MBUF_SECTS setting
+#endif
+
+static BYTE MBufPool[_FS_MBUF][_FS_MBUF_SECTS * _MAX_SS] SD_FRAM_BSS;	/* Too large for SRAM */
+static FIL* MBufOwner[_FS_MBUF];
+
+
+static
+void __attribute__((section(".upper.text"))) mbuf_get (
+	FIL* fp			/* File being opened for writing */
+)
+{
+	FIL *o;
+	UINT i;
+
+
+	for (i = 0; i < _FS_MBUF; i++) {
+		o = MBufOwner[i];
+		if (!o || !o->fs || o->mbuf != MBufPool[i] || o->id != o->fs->id) {	/* Free, closed or stale */
+			MBufOwner[i] = fp;
+			fp->mbuf = MBufPool[i];
+			break;
+		}
+	}
+}
+
+
+static
+void __attribute__((section(".upper.text"))) mbuf_put (
+	FIL* fp			/* File being closed */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_MBUF; i++) {
+		if (MBufOwner[i] == fp) MBufOwner[i] = 0;
+	}
+	fp->mbuf = 0;
+}
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) mbuf_sync (	/* Write the staged run */
+	FIL* fp
+)
+{
+	if (fp->mcnt) {
+		if (disk_write(fp->fs->drv, fp->mbuf, fp->msect, fp->mcnt))
+			return FR_DISK_ERR;
+		fp->mcnt = 0;
+	}
+	return FR_OK;
+}
+
+
+static
+void __attribute__((section(".upper.text"))) mbuf_patch (	/* Overlay staged sectors on a direct read */
+	FIL* fp,
+	BYTE* buff,		/* Sectors read from the disk */
+	DWORD sect,		/* First sector in buff */
+	UINT cnt		/* Sectors in buff */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fp->mcnt; i++) {
+		if (fp->msect + i - sect < cnt)
+			mem_cpy(buff + (fp->msect + i - sect) * SS(fp->fs), fp->mbuf + i * SS(fp->fs), SS(fp->fs));
+	}
+}
+#endif
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) fbuf_flush (	/* Write back buf[] if dirty */
+	FIL* fp
+)
+{
+#if !_FS_READONLY
+#if !_FS_TINY && _FS_MBUF
+	DWORD i;
+#endif
+
+	if (fp->flag & FA__DIRTY) {
+#if !_FS_TINY && _FS_MBUF
+		if (fp->mbuf) {
+			i = fp->dsect - fp->msect;
+			if (fp->mcnt && i > fp->mcnt) {		/* Does not follow the run */
+				if (mbuf_sync(fp)) return FR_DISK_ERR;
+			}
+			if (!fp->mcnt) {
+				fp->msect = fp->dsect; i = 0;
+			}
+			mem_cpy(fp->mbuf + i * SS(fp->fs), fp->buf, SS(fp->fs));	/* Stage it */
+			if (i == fp->mcnt) fp->mcnt++;
+			fp->flag &= ~FA__DIRTY;
+			return (fp->mcnt == _FS_MBUF_SECTS) ? mbuf_sync(fp) : FR_OK;
+		}
+#endif
+		if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
+			return FR_DISK_ERR;
+		fp->flag &= ~FA__DIRTY;
+	}
+#endif
+	return FR_OK;
+}
+
+
+static
+FRESULT __attribute__((section(".upper.text"))) fbuf_fill (	/* Load a sector into buf[] */
+	FIL* fp,
+	DWORD sect		/* Sector to load */
+)
+{
+#if !_FS_TINY && !_FS_READONLY && _FS_MBUF
+	if (sect - fp->msect < fp->mcnt) {		/* Staged copy is the newest */
+		mem_cpy(fp->buf, fp->mbuf + (sect - fp->msect) * SS(fp->fs), SS(fp->fs));
+		return FR_OK;
+	}
+#endif
+#if _FS_TINY && _FS_DATABUFS
+	if (fbuf_get(fp, 0) != FR_OK) return FR_DISK_ERR;
+#endif
+	return disk_read(fp->fs->drv, fp->buf, sect, 1) ? FR_DISK_ERR : FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Point the directory entry at a new chain                              */
+/*-----------------------------------------------------------------------*/
+/* With the journal, a new chain goes into the same batch as the entry   */
+/* pointing at it, so a batch committed by a sync of another file cannot */
+/* leave the chain stranded. The size is still left to f_sync().         */
+#if !_FS_READONLY && _FS_JOURNAL
+static
+FRESULT __attribute__((section(".upper.text"))) point_entry (
+	FIL* fp			/* File whose chain is linked on the FAT */
+)
+{
+	FRESULT res;
+
+
+	if (!(fp->flag & FA__NEWCHAIN)) return FR_OK;
+	res = move_window(fp->fs, fp->dir_sect);
+	if (res == FR_OK) {
+		st_clust(fp->dir_ptr, fp->sclust);
+		fp->fs->wflag = 1;
+		fp->flag &= ~FA__NEWCHAIN;
+	}
+	return res;
+}
+
+
+/* f_truncate() is the reverse case: the entry takes the new size and    */
+/* start cluster before the chain is cut, so no batch can free clusters  */
+/* the entry still claims. A cut committed part way leaves lost clusters. */
+static
+FRESULT __attribute__((section(".upper.text"))) trim_entry (
+	FIL* fp			/* File with the new size and start cluster set */
+)
+{
+	FRESULT res;
+
+
+	res = move_window(fp->fs, fp->dir_sect);
+	if (res == FR_OK) {
+		st_clust(fp->dir_ptr, fp->sclust);
+		ST_DWORD(fp->dir_ptr+DIR_FileSize, fp->fsize);
+		fp->fs->wflag = 1;
+		fp->flag &= ~FA__NEWCHAIN;
+	}
+	return res;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Delayed allocation - Take and link reserved clusters                  */
+/*-----------------------------------------------------------------------*/
+/* A file growing past the end of its chain takes a run of free clusters */
+/* and writes into it with no FAT update. Only rsv_end() keeps the other */
+/* allocations off the run until dalloc_commit() links the clusters used */
+/* onto the chain in one pass and lets the rest go.                      */
+#if !_FS_READONLY && _FS_DELALLOC
+static
+FRESULT __attribute__((section(".upper.text"))) dalloc_commit (
+	FIL* fp			/* File holding a reserved run or not */
+)
+{
+	FATFS *fs = fp->fs;
+	DWORD clst;
+	FRESULT res = FR_OK;
+
+
+	if (!fp->rsv_start) return FR_OK;
+	if (fp->rsv_tail)						/* Append the run to the chain */
+		res = put_fat(fs, fp->rsv_tail, fp->rsv_start);
+	for (clst = fp->rsv_start; res == FR_OK && clst <= fp->clust; clst++)	/* Link the clusters used */
+		res = put_fat(fs, clst, (clst == fp->clust) ? 0x0FFFFFFF : clst + 1);
+#if _FS_JOURNAL
+	if (res == FR_OK && !fp->rsv_tail)
+		res = point_entry(fp);
+#endif
+	if (res != FR_OK) return res;
+
+	fs->last_clust = fp->clust;
+	if (fs->free_clust != 0xFFFFFFFF) {		/* Update FSINFO */
+		fs->free_clust -= fp->clust + 1 - fp->rsv_start;
+		fs->fsi_flag |= 1;
+	}
+	fp->rsv_start = 0;						/* Unused clusters of the run are free again */
+	return FR_OK;
+}
+
+
+static
+DWORD __attribute__((section(".upper.text"))) dalloc_next (	/* 0:Disk full, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Next cluster# */
+	FIL* fp			/* File on a cluster boundary in f_write() */
+)
+{
+	FATFS *fs = fp->fs;
+	DWORD cs, ncl, scl;
+	FIL *o;
+	UINT i;
+
+
+	if (fp->rsv_start) {					/* Writing into a reserved run */
+		if (fp->clust + 1 < fp->rsv_end) return fp->clust + 1;
+		cs = dalloc_commit(fp);				/* Used up */
+		if (cs != FR_OK) return (cs == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+	}
+	if (fp->sclust) {						/* Follow the chain while it goes on */
+		cs = get_fat(fs, fp->clust);
+		if (cs < 2) return 1;
+		if (cs == 0xFFFFFFFF || cs < fs->n_fatent) return cs;
+		scl = fp->clust;
+	} else {
+		scl = fs->last_clust;
+		if (!scl || scl >= fs->n_fatent) scl = 1;
+	}
+
+	for (i = 0; i < _FS_DELALLOC_FILES; i++) {	/* Find a free owner slot */
+		o = RsvOwner[i];
+		if (!o || o == fp || !o->fs || o->id != o->fs->id || !o->rsv_start) break;
+	}
+	if (i == _FS_DELALLOC_FILES)			/* None, allocate as usual */
+		return create_chain(fs, fp->sclust ? fp->clust : 0);
+
+	ncl = find_free(fs, scl);
+	if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+	for (cs = ncl + 1; cs < fs->n_fatent && cs - ncl < _FS_DELALLOC; cs++) {	/* Stretch the run over free clusters */
+		scl = get_fat(fs, cs);
+		if (scl == 0xFFFFFFFF) return scl;
+		if (scl != 0 || busy_end(fs, cs)) break;
+	}
+	RsvOwner[i] = fp;
+	fp->rsv_tail = fp->sclust ? fp->clust : 0;
+	fp->rsv_start = ncl;
+	fp->rsv_end = cs;
+	return ncl;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Open or Create a File                                                 */
+/*-----------------------------------------------------------------------*/
+
+//FRESULT __attribute__ ((section (".upper.text"))) f_open (
+FRESULT __attribute__((section(".upper.text"))) f_open (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name */
+	BYTE mode			/* Access mode and file open mode flags */
+)
+{
+	FRESULT res;
+	DIR dj;
+	BYTE *dir;
+#if !_FS_READONLY
+	BYTE append;
+#endif
+	DEF_NAMEBUF;
+
+
+	if (!fp) 
+    return FR_INVALID_OBJECT;
+	fp->fs = 0;			/* Clear file object */
+
+	/* Get logical drive number */
+#if !_FS_READONLY
+	append = (mode & FA_OPEN_APPEND) == FA_OPEN_APPEND;
+	mode &= FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW;
+	res = find_volume(&dj.fs, &path, (BYTE)(mode & ~FA_READ));
+#else
+	mode &= FA_READ;
+	res = find_volume(&dj.fs, &path, 0);
+#endif
+	if (res == FR_OK) {
 		INIT_BUF(dj);
 		res = follow_path(&dj, path);	/* Follow the file path */
 		dir = dj.dir;
@@ -2423,23 +3890,233 @@ FRESULT __attribute__((section(".upper.text"))) f_open (
 #endif
 		FREE_BUF();
 
-		if (res == FR_OK) {
-			fp->flag = mode;					/* File access mode */
-			fp->err = 0;						/* Clear error flag */
-			fp->sclust = ld_clust(dj.fs, dir);	/* File start cluster */
-			fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
-			fp->fptr = 0;						/* File pointer */
-			fp->dsect = 0;
+		if (res == FR_OK) {
+			fp->flag = mode;					/* File access mode */
+			fp->err = 0;						/* Clear error flag */
+			fp->sclust = ld_clust(dj.fs, dir);	/* File start cluster */
+			fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
+			fp->fptr = 0;						/* File pointer */
+			fp->dsect = 0;
+#if _USE_FASTSEEK
+			fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _FS_TINY && _FS_DATABUFS
+			fp->buf = 0;						/* Data buffer is lent on first use */
+#endif
+#if !_FS_TINY && !_FS_READONLY && _FS_MBUF
+			fp->mbuf = 0; fp->mcnt = 0;
+#endif
+#if !_FS_READONLY && _FS_DELALLOC
+			fp->rsv_start = 0;
+#endif
+#if !_FS_READONLY
+			if (append && fp->fsize)			/* Start at the end of the file */
+				res = seek_tail(fp, dj.fs);
+			if (res == FR_OK)
+#endif
+			{
+				fp->fs = dj.fs;					/* Validate file object */
+				fp->id = fp->fs->id;
+#if !_FS_TINY && !_FS_READONLY && _FS_MBUF
+				if (mode & FA_WRITE) mbuf_get(fp);	/* Multi-sector write buffer, if one is free */
+#endif
+			}
+		}
+	}
+
+	LEAVE_FF(dj.fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Create a File with the Next Free Number                               */
+/*-----------------------------------------------------------------------*/
+/* The last path segment is an 8.3 name with one run of '#', such as      */
+/* "LOG#####.BIN", and is not looked up itself. One pass over the         */
+/* directory finds the highest number in use and a free entry, and the    */
+/* new entry is written there directly. The next number and the entry    */
+/* after it are then cached, so a run of creations in the same directory  */
+/* does not scan it again. The cache is dropped on remount, and by       */
+/* numname_drop() when a matching name is created by other means.         */
+#if !_FS_READONLY && _USE_NUMNAME
+
+FRESULT __attribute__((section(".upper.text"))) f_opennum (
+	FIL* fp,			/* Pointer to the blank file object */
+	const TCHAR* path,	/* Pointer to the file name pattern */
+	BYTE mode,			/* Access mode flags (FA_READ, FA_WRITE) */
+	DWORD* num			/* Number given to the file (can be null) */
+)
+{
+	FRESULT res;
+	DIR dj;
+	NUMNAME *nn;
+	BYTE *dir, c;
+	UINT i, p0, nd, fidx;
+	DWORD n, hi, lim;
+	DEF_NAMEBUF;
+
+
+	if (!fp)
+		return FR_INVALID_OBJECT;
+	fp->fs = 0;			/* Clear file object */
+
+	res = find_volume(&dj.fs, &path, 1);
+	if (res != FR_OK) LEAVE_FF(dj.fs, res);
+	INIT_BUF(dj);
+#if _FS_RPATH
+	if (*path == '/' || *path == '\\') {	/* There is a heading separator */
+		path++;	dj.sclust = 0;				/* Strip it and start from the root directory */
+	} else {								/* No heading separator */
+		dj.sclust = dj.fs->cdir;			/* Start from the current directory */
+	}
+#else
+	if (*path == '/' || *path == '\\')		/* Strip heading separator if exist */
+		path++;
+	dj.sclust = 0;							/* Always start from the root directory */
+#endif
+	for (;;) {							/* Follow the directories, like follow_path() */
+		res = create_name(&dj, &path);
+		if (res != FR_OK) break;
+		if (dj.fn[NS] & NS_LAST) {		/* The pattern is not looked up */
+			res = FR_NO_FILE; break;
+		}
+		res = dir_find(&dj);
+		if (res == FR_NO_FILE) res = FR_NO_PATH;
+		if (res != FR_OK) break;
+		if (!(dj.dir[DIR_Attr] & AM_DIR)) {
+			res = FR_NO_PATH; break;
+		}
+		dj.sclust = ld_clust(dj.fs, dj.dir);
+	}
+#if _USE_LFN
+	if (res == FR_NO_FILE && (dj.fn[NS] & (NS_LOSS | NS_LFN)))	/* The pattern must be an SFN */
+		res = FR_INVALID_NAME;
+#endif
+	for (p0 = 0; p0 < 11 && dj.fn[p0] != '#'; p0++) ;	/* Locate the run of '#' */
+	for (nd = 0; p0 + nd < 11 && dj.fn[p0 + nd] == '#'; nd++) ;
+	for (i = p0 + nd; i < 11 && dj.fn[i] != '#'; i++) ;
+	if (res == FR_NO_FILE && (!nd || nd > 8 || i < 11))
+		res = FR_INVALID_NAME;
+#if _FS_LOCK
+	if (res == FR_NO_FILE && !enq_lock())
+		res = FR_TOO_MANY_OPEN_FILES;
+#endif
+	if (res != FR_NO_FILE) {
+		FREE_BUF();
+		LEAVE_FF(dj.fs, res);
+	}
+	for (lim = 1, i = 0; i < nd; i++) lim *= 10;	/* First number that does not fit */
+
+	/* Take the cached number and entry if they are still good */
+	for (nn = NumName; nn < NumName + _USE_NUMNAME; nn++) {
+		if (nn->fs == dj.fs && nn->id == dj.fs->id && nn->sclust == dj.sclust && !mem_cmp(nn->pat, dj.fn, 11))
+			break;
+	}
+	res = FR_NO_FILE;
+	if (nn < NumName + _USE_NUMNAME) {
+		n = nn->next;
+		if (dir_sdi(&dj, nn->index) == FR_OK && move_window(dj.fs, dj.sect) == FR_OK
+			&& (dj.dir[DIR_Name] == 0 || dj.dir[DIR_Name] == DDE))
+			res = FR_OK;
+	} else {
+		nn = &NumName[NumNext];			/* Replace the cached directories in turn */
+		NumNext = (BYTE)((NumNext + 1) % _USE_NUMNAME);
+		nn->fs = 0;
+	}
+
+	if (res != FR_OK) {					/* Scan the directory once */
+		hi = 0; fidx = 0xFFFF;
+		res = dir_sdi(&dj, 0);
+		while (res == FR_OK) {
+			res = move_window(dj.fs, dj.sect);
+			if (res != FR_OK) break;
+			dir = dj.dir;
+			c = dir[DIR_Name];
+			if (c == 0 || c == DDE) {		/* Free entry */
+				if (fidx == 0xFFFF) fidx = dj.index;
+				if (c == 0) break;			/* End of table, the rest is free */
+			} else if (!(dir[DIR_Attr] & AM_VOL)) {	/* An SFN entry (not LFN or label) */
+				for (i = 0; i < 11; i++) {
+					if (i >= p0 && i < p0 + nd) {
+						if (!IsDigit(dir[i])) break;
+					} else {
+						if (dir[i] != dj.fn[i]) break;
+					}
+				}
+				if (i == 11) {				/* Name matches the pattern */
+					for (n = 0, i = p0; i < p0 + nd; i++) n = n * 10 + dir[i] - '0';
+					if (n > hi) hi = n;
+				}
+			}
+			res = dir_next(&dj, fidx == 0xFFFF);	/* Stretch the table only when it is full */
+		}
+		if (res == FR_NO_FILE)			/* End of a table that cannot grow */
+			res = (fidx == 0xFFFF) ? FR_DENIED : FR_OK;
+		if (res == FR_OK) res = dir_sdi(&dj, fidx);
+		if (res == FR_OK) res = move_window(dj.fs, dj.sect);
+		n = hi + 1;
+	}
+	if (res == FR_OK && n >= lim)		/* Numbers used up */
+		res = FR_DENIED;
+
+	if (res == FR_OK) {					/* Create the entry */
+		if (!nn->fs) {
+			mem_cpy(nn->pat, dj.fn, 11);
+			nn->sclust = dj.sclust;
+		}
+		for (hi = n, i = p0 + nd; i > p0; hi /= 10)	/* Put the number in the name */
+			dj.fn[--i] = (BYTE)('0' + hi % 10);
+		dir = dj.dir;
+		mem_set(dir, 0, SZ_DIR);			/* Clean the entry */
+		mem_cpy(dir, dj.fn, 11);			/* Put SFN */
+		ST_DWORD(dir+DIR_CrtTime, get_fattime());	/* Created time */
+		dj.fs->wflag = 1;
+		nn->fs = dj.fs;						/* The following entry is likely free as well */
+		nn->id = dj.fs->id;
+		nn->index = dj.index + 1;
+		nn->next = n + 1;
+
+		fp->dir_sect = dj.fs->winsect;		/* Pointer to the directory entry */
+		fp->dir_ptr = dir;
+#if _FS_LOCK
+		fp->lockid = inc_lock(&dj, 1);
+		if (!fp->lockid) res = FR_INT_ERR;
+#endif
+	} else {
+		nn->fs = 0;
+	}
+	FREE_BUF();
+
+	if (res == FR_OK) {
+		fp->flag = (mode & (FA_READ | FA_WRITE)) | FA_CREATE_NEW | FA__WRITTEN;	/* File access mode */
+		fp->err = 0;						/* Clear error flag */
+		fp->sclust = 0;						/* File start cluster */
+		fp->fsize = 0;						/* File size */
+		fp->fptr = 0;						/* File pointer */
+		fp->dsect = 0;
 #if _USE_FASTSEEK
-			fp->cltbl = 0;						/* Normal seek mode */
+		fp->cltbl = 0;						/* Normal seek mode */
 #endif
-			fp->fs = dj.fs;	 					/* Validate file object */
-			fp->id = fp->fs->id;
-		}
+#if _FS_TINY && _FS_DATABUFS
+		fp->buf = 0;						/* Data buffer is lent on first use */
+#endif
+#if _FS_DELALLOC
+		fp->rsv_start = 0;
+#endif
+		fp->fs = dj.fs;						/* Validate file object */
+		fp->id = fp->fs->id;
+#if !_FS_TINY && _FS_MBUF
+		fp->mbuf = 0; fp->mcnt = 0;
+		if (mode & FA_WRITE) mbuf_get(fp);	/* Multi-sector write buffer, if one is free */
+#endif
+		if (num) *num = n;
 	}
 
 	LEAVE_FF(dj.fs, res);
 }
+#endif
 
 
 
@@ -2469,6 +4146,14 @@ FRESULT __attribute__((section(".upper.text"))) f_read (
 		LEAVE_FF(fp->fs, (FRESULT)fp->err);
 	if (!(fp->flag & FA_READ)) 					/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
+#if !_FS_READONLY && _FS_DELALLOC
+	res = dalloc_commit(fp);					/* The chain is followed on the FAT */
+	if (res != FR_OK) ABORT(fp->fs, res);
+#endif
+#if _FS_TINY && _FS_DATABUFS
+	if (fbuf_get(fp, 1) != FR_OK)				/* Borrow a data buffer */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 	remain = fp->fsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
@@ -2501,7 +4186,10 @@ FRESULT __attribute__((section(".upper.text"))) f_read (
 				if (disk_read(fp->fs->drv, rbuff, sect, cc))
 					ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
-#if _FS_TINY
+#if !_FS_TINY && _FS_MBUF
+				mbuf_patch(fp, rbuff, sect, cc);	/* Staged sectors first, buf[] is newer still */
+#endif
+#if _FS_DATAWIN
 				if (fp->fs->wflag && fp->fs->winsect - sect < cc)
 					mem_cpy(rbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), fp->fs->win, SS(fp->fs));
 #else
@@ -2512,16 +4200,11 @@ FRESULT __attribute__((section(".upper.text"))) f_read (
 				rcnt = SS(fp->fs) * cc;			/* Number of bytes transferred */
 				continue;
 			}
-#if !_FS_TINY
+#if !_FS_DATAWIN
 			if (fp->dsect != sect) {			/* Load data sector if not in cache */
-#if !_FS_READONLY
-				if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
-					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
-						ABORT(fp->fs, FR_DISK_ERR);
-					fp->flag &= ~FA__DIRTY;
-				}
-#endif
-				if (disk_read(fp->fs->drv, fp->buf, sect, 1))	/* Fill sector cache */
+				if (fbuf_flush(fp))				/* Write-back dirty sector cache */
+					ABORT(fp->fs, FR_DISK_ERR);
+				if (fbuf_fill(fp, sect))		/* Fill sector cache */
 					ABORT(fp->fs, FR_DISK_ERR);
 			}
 #endif
@@ -2529,7 +4212,7 @@ FRESULT __attribute__((section(".upper.text"))) f_read (
 		}
 		rcnt = SS(fp->fs) - ((UINT)fp->fptr % SS(fp->fs));	/* Get partial sector data from sector buffer */
 		if (rcnt > btr) rcnt = btr;
-#if _FS_TINY
+#if _FS_DATAWIN
 		if (move_window(fp->fs, fp->dsect))		/* Move sector window */
 			ABORT(fp->fs, FR_DISK_ERR);
 		mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
@@ -2538,6 +4221,9 @@ FRESULT __attribute__((section(".upper.text"))) f_read (
 #endif
 	}
 
+#if _FS_TINY && _FS_DATABUFS
+	fbuf_rest(fp);								/* Clean buffer: free to be taken */
+#endif
 	LEAVE_FF(fp->fs, FR_OK);
 }
 
@@ -2572,6 +4258,10 @@ FRESULT __attribute__((section(".upper.text"))) f_write (
 	if (!(fp->flag & FA_WRITE))				/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
 	if (fp->fptr + btw < fp->fptr) btw = 0;	/* File size cannot reach 4GB */
+#if _FS_TINY && _FS_DATABUFS
+	if (fbuf_get(fp, 1) != FR_OK)			/* Borrow a data buffer */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 
 	for ( ;  btw;							/* Repeat until all data written */
 		wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
@@ -2581,30 +4271,45 @@ FRESULT __attribute__((section(".upper.text"))) f_write (
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;		/* Follow from the origin */
 					if (clst == 0)			/* When no cluster is allocated, */
+#if _FS_DELALLOC
+						clst = dalloc_next(fp);	/* Reserve a run for the new chain */
+#else
 						clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
+#endif
 				} else {					/* Middle or end of the file */
 #if _USE_FASTSEEK
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
+#if _FS_DELALLOC
+						clst = dalloc_next(fp);	/* Follow the chain or take the next reserved cluster */
+#else
 						clst = create_chain(fp->fs, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+#endif
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 				fp->clust = clst;			/* Update current cluster */
-				if (fp->sclust == 0) fp->sclust = clst;	/* Set start cluster if the first write */
+				if (fp->sclust == 0) {		/* Set start cluster if the first write */
+					fp->sclust = clst;
+					fp->flag |= FA__NEWCHAIN;	/* Directory entry does not point at the chain yet */
+				}
+#if _FS_JOURNAL
+#if _FS_DELALLOC
+				if (!fp->rsv_start)			/* A reserved run is pointed at once it is linked */
+#endif
+				if (point_entry(fp) != FR_OK)
+					ABORT(fp->fs, FR_DISK_ERR);
+#endif
 			}
-#if _FS_TINY
+#if _FS_DATAWIN
 			if (fp->fs->winsect == fp->dsect && sync_window(fp->fs))	/* Write-back sector cache */
 				ABORT(fp->fs, FR_DISK_ERR);
 #else
-			if (fp->flag & FA__DIRTY) {		/* Write-back sector cache */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
-					ABORT(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
-			}
+			if (fbuf_flush(fp))				/* Write-back sector cache */
+				ABORT(fp->fs, FR_DISK_ERR);
 #endif
 			sect = clust2sect(fp->fs, fp->clust);	/* Get current sector */
 			if (!sect) ABORT(fp->fs, FR_INT_ERR);
@@ -2613,10 +4318,14 @@ FRESULT __attribute__((section(".upper.text"))) f_write (
 			if (cc) {						/* Write maximum contiguous sectors directly */
 				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
 					cc = fp->fs->csize - csect;
+#if !_FS_TINY && _FS_MBUF
+				if (fp->mcnt && fp->msect < sect + cc && sect < fp->msect + fp->mcnt && mbuf_sync(fp))
+					ABORT(fp->fs, FR_DISK_ERR);	/* Staged copies must not land on the new data */
+#endif
 				if (disk_write(fp->fs->drv, wbuff, sect, cc))
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_MINIMIZE <= 2
-#if _FS_TINY
+#if _FS_DATAWIN
 				if (fp->fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
 					mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
 					fp->fs->wflag = 0;
@@ -2631,27 +4340,26 @@ FRESULT __attribute__((section(".upper.text"))) f_write (
 				wcnt = SS(fp->fs) * cc;		/* Number of bytes transferred */
 				continue;
 			}
-#if _FS_TINY
+#if _FS_DATAWIN
 			if (fp->fptr >= fp->fsize) {	/* Avoid silly cache filling at growing edge */
 				if (sync_window(fp->fs)) ABORT(fp->fs, FR_DISK_ERR);
 				fp->fs->winsect = sect;
 			}
 #else
 			if (fp->dsect != sect) {		/* Fill sector cache with file data */
-				if (fp->fptr < fp->fsize &&
-					disk_read(fp->fs->drv, fp->buf, sect, 1))
-						ABORT(fp->fs, FR_DISK_ERR);
+				if (fp->fptr < fp->fsize && fbuf_fill(fp, sect))
+					ABORT(fp->fs, FR_DISK_ERR);
 			}
 #endif
 			fp->dsect = sect;
 		}
 		wcnt = SS(fp->fs) - ((UINT)fp->fptr % SS(fp->fs));/* Put partial sector into file I/O buffer */
 		if (wcnt > btw) wcnt = btw;
-#if _FS_TINY
+#if _FS_DATAWIN
 		if (move_window(fp->fs, fp->dsect))	/* Move sector window */
 			ABORT(fp->fs, FR_DISK_ERR);
 		mem_cpy(&fp->fs->win[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
-		fp->fs->wflag = 1;
+		fp->fs->wflag = 2;					/* File data, not journaled */
 #else
 		mem_cpy(&fp->buf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
 		fp->flag |= FA__DIRTY;
@@ -2661,6 +4369,9 @@ FRESULT __attribute__((section(".upper.text"))) f_write (
 	if (fp->fptr > fp->fsize) fp->fsize = fp->fptr;	/* Update file size if needed */
 	fp->flag |= FA__WRITTEN;						/* Set file change flag */
 
+#if _FS_TINY && _FS_DATABUFS
+	fbuf_rest(fp);									/* Stays pinned while dirty */
+#endif
 	LEAVE_FF(fp->fs, FR_OK);
 }
 
@@ -2683,13 +4394,21 @@ FRESULT __attribute__((section(".upper.text"))) f_sync (
 	res = validate(fp);					/* Check validity of the object */
 	if (res == FR_OK) {
 		if (fp->flag & FA__WRITTEN) {	/* Has the file been written? */
+#if _FS_DELALLOC
+			res = dalloc_commit(fp);	/* Link the reserved clusters used */
+			if (res != FR_OK) LEAVE_FF(fp->fs, res);
+#endif
 			/* Write-back dirty buffer */
-#if !_FS_TINY
-			if (fp->flag & FA__DIRTY) {
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
-					LEAVE_FF(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
-			}
+#if !_FS_DATAWIN
+			if (fbuf_flush(fp))
+				LEAVE_FF(fp->fs, FR_DISK_ERR);
+#if _FS_TINY && _FS_DATABUFS
+			fbuf_rest(fp);				/* Clean now, free to be taken */
+#endif
+#if !_FS_TINY && _FS_MBUF
+			if (mbuf_sync(fp))
+				LEAVE_FF(fp->fs, FR_DISK_ERR);
+#endif
 #endif
 			/* Update the directory entry */
 			res = move_window(fp->fs, fp->dir_sect);
@@ -2701,8 +4420,11 @@ FRESULT __attribute__((section(".upper.text"))) f_sync (
 				tm = get_fattime();							/* Update updated time */
 				ST_DWORD(dir+DIR_WrtTime, tm);
 				ST_WORD(dir+DIR_LstAccDate, 0);
-				fp->flag &= ~FA__WRITTEN;
+				fp->flag &= ~(FA__WRITTEN | FA__NEWCHAIN);
 				fp->fs->wflag = 1;
+#if _FS_TAIL_HINTS
+				tail_note(fp, fp->fs, (fp->fsize && fp->fptr == fp->fsize) ? fp->clust : 0);
+#endif
 				res = sync_fs(fp->fs);
 			}
 		}
@@ -2711,6 +4433,144 @@ FRESULT __attribute__((section(".upper.text"))) f_sync (
 	LEAVE_FF(fp->fs, res);
 }
 
+
+
+
+#if _USE_DATASYNC
+/*-----------------------------------------------------------------------*/
+/* Synchronize the File Data                                             */
+/*-----------------------------------------------------------------------*/
+/* Unlike f_sync(), the directory entry and the FSINFO sector are left    */
+/* as they are, so a sync costs the data and FAT sectors only. The entry  */
+/* keeps the size of the last f_sync(); f_recover_size() rebuilds it from */
+/* the cluster chain after power loss. FA__WRITTEN stays set so the next  */
+/* f_sync() or f_close() still updates the entry.                         */
+
+FRESULT __attribute__((section(".upper.text"))) f_datasync (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	FRESULT res;
+
+
+	res = validate(fp);					/* Check validity of the object */
+	if (res == FR_OK && (fp->flag & FA__WRITTEN)) {
+		if (fp->flag & FA__NEWCHAIN) {	/* The entry must point at the chain once */
+#if _FS_REENTRANT
+			unlock_fs(fp->fs, FR_OK);
+#endif
+			return f_sync(fp);
+		}
+#if _FS_DELALLOC
+		res = dalloc_commit(fp);		/* Link the reserved clusters used */
+		if (res != FR_OK) LEAVE_FF(fp->fs, res);
+#endif
+#if !_FS_DATAWIN
+		if (fbuf_flush(fp))				/* Write-back dirty buffer */
+			LEAVE_FF(fp->fs, FR_DISK_ERR);
+#if _FS_TINY && _FS_DATABUFS
+		fbuf_rest(fp);
+#endif
+#if !_FS_TINY && _FS_MBUF
+		if (mbuf_sync(fp))
+			LEAVE_FF(fp->fs, FR_DISK_ERR);
+#endif
+#endif
+		res = sync_window(fp->fs);		/* Data sector (tiny) or FAT sector */
+#if _FS_FATRES
+		if (res == FR_OK)
+			res = fat_flush(fp->fs);	/* Or the resident FAT */
+#endif
+		if (res == FR_OK && disk_ioctl(fp->fs->drv, CTRL_SYNC, 0) != RES_OK)
+			res = FR_DISK_ERR;
+#if _FS_JOURNAL
+		if (res == FR_OK)
+			res = jrn_commit(fp->fs);	/* The FAT links must survive a power loss */
+#endif
+	}
+
+	LEAVE_FF(fp->fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Recover the File Size                                                 */
+/*-----------------------------------------------------------------------*/
+/* Walks the cluster chain from the sector holding the recorded end of    */
+/* the file and passes each sector to sect_len(), which returns how many  */
+/* of its bytes belong to the file. The scan stops at the first sector    */
+/* returning less than a full sector, or at the end of the chain. A size  */
+/* grown this way is written to the directory entry with f_sync().        */
+
+FRESULT __attribute__((section(".upper.text"))) f_recover_size (
+	FIL* fp,								/* Pointer to the file object opened with FA_WRITE */
+	UINT (*sect_len)(const BYTE*, void*),	/* Length marker: valid bytes in a sector */
+	void* arg								/* Passed through to sect_len() */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD clst, sect, pos, ncl;
+	UINT n, csect;
+
+
+	res = validate(fp);						/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fp->fs, FR_DENIED);
+	fs = fp->fs;
+	if (!fp->sclust) LEAVE_FF(fs, FR_OK);	/* No chain to recover from */
+#if _FS_DELALLOC
+	res = dalloc_commit(fp);				/* The scan follows the FAT */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
+#if !_FS_DATAWIN
+	if (fbuf_flush(fp))						/* The scan reads through fs->win, not buf[] */
+		LEAVE_FF(fs, FR_DISK_ERR);
+#if !_FS_TINY && _FS_MBUF
+	if (mbuf_sync(fp))
+		LEAVE_FF(fs, FR_DISK_ERR);
+#endif
+#endif
+
+	pos = fp->fsize - fp->fsize % SS(fs);	/* Re-check the partly filled last sector */
+	clst = fp->sclust;						/* Find the cluster holding pos */
+	for (ncl = pos / SS(fs) >> fs->csize_sh; ncl && clst >= 2 && clst < fs->n_fatent; ncl--)
+		clst = get_fat(fs, clst);
+	csect = (UINT)(pos / SS(fs) & (fs->csize - 1));
+
+	while (res == FR_OK && clst >= 2 && clst < fs->n_fatent) {
+		sect = clust2sect(fs, clst);
+		for ( ; csect < fs->csize; csect++) {
+			if (move_window(fs, sect + csect)) {
+				res = FR_DISK_ERR;
+				break;
+			}
+			n = sect_len(fs->win, arg);
+			pos += n;
+			if (n < SS(fs)) break;
+		}
+		if (res != FR_OK || csect < fs->csize) break;	/* Length marker ended the file */
+		csect = 0;
+		clst = get_fat(fs, clst);
+	}
+	if (clst == 1) res = FR_INT_ERR;
+	if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
+
+	if (res == FR_OK && pos > fp->fsize) {
+		fp->fsize = pos;
+		fp->flag |= FA__WRITTEN;
+	}
+#if _FS_REENTRANT
+	unlock_fs(fs, res);
+#endif
+	if (res == FR_OK && (fp->flag & FA__WRITTEN))
+		res = f_sync(fp);					/* Record the recovered size */
+	return res;
+}
+#endif /* _USE_DATASYNC */
+
 #endif /* !_FS_READONLY */
 
 
@@ -2737,6 +4597,12 @@ FRESULT __attribute__((section(".upper.text"))) f_close (
 #if _FS_REENTRANT
 			FATFS *fs = fp->fs;
 #endif
+#if !_FS_TINY && !_FS_READONLY && _FS_MBUF
+			mbuf_put(fp);				/* Return the write buffer to the pool */
+#endif
+#if _FS_TINY && _FS_DATABUFS
+			fbuf_put(fp);				/* Return the data buffer to the pool */
+#endif
 #if _FS_LOCK
 			res = dec_lock(fp->lockid);	/* Decrement file open counter */
 			if (res == FR_OK)
@@ -2904,6 +4770,10 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->err)						/* Check error */
 		LEAVE_FF(fp->fs, (FRESULT)fp->err);
+#if !_FS_READONLY && _FS_DELALLOC
+	res = dalloc_commit(fp);			/* The chain is followed on the FAT */
+	if (res != FR_OK) ABORT(fp->fs, res);
+#endif
 
 #if _USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
@@ -2944,15 +4814,10 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 				if (!dsc) ABORT(fp->fs, FR_INT_ERR);
 				dsc += (ofs - 1) / SS(fp->fs) & (fp->fs->csize - 1);
 				if (fp->fptr % SS(fp->fs) && dsc != fp->dsect) {	/* Refill sector cache if needed */
-#if !_FS_TINY
-#if !_FS_READONLY
-					if (fp->flag & FA__DIRTY) {		/* Write-back dirty sector cache */
-						if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
-							ABORT(fp->fs, FR_DISK_ERR);
-						fp->flag &= ~FA__DIRTY;
-					}
-#endif
-					if (disk_read(fp->fs->drv, fp->buf, dsc, 1))	/* Load current sector */
+#if !_FS_DATAWIN
+					if (fbuf_flush(fp))				/* Write-back dirty sector cache */
+						ABORT(fp->fs, FR_DISK_ERR);
+					if (fbuf_fill(fp, dsc))			/* Load current sector */
 						ABORT(fp->fs, FR_DISK_ERR);
 #endif
 					fp->dsect = dsc;
@@ -2975,9 +4840,9 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 		ifptr = fp->fptr;
 		fp->fptr = nsect = 0;
 		if (ofs) {
-			bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
+			bcs = (DWORD)SS(fp->fs) << fp->fs->csize_sh;	/* Cluster size (byte) */
 			if (ifptr > 0 &&
-				(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
+				(ofs - 1) / SS(fp->fs) >> fp->fs->csize_sh >= (ifptr - 1) / SS(fp->fs) >> fp->fs->csize_sh) {	/* When seek to same or following cluster, */
 				fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
 				ofs -= fp->fptr;
 				clst = fp->clust;
@@ -2989,6 +4854,11 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					fp->sclust = clst;
+					fp->flag |= FA__NEWCHAIN;			/* Directory entry does not point at the chain yet */
+#if _FS_JOURNAL
+					if (point_entry(fp) != FR_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+#endif
 				}
 #endif
 				fp->clust = clst;
@@ -3019,15 +4889,10 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 			}
 		}
 		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
-#if !_FS_TINY
-#if !_FS_READONLY
-			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
-					ABORT(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
-			}
-#endif
-			if (disk_read(fp->fs->drv, fp->buf, nsect, 1))	/* Fill sector cache */
+#if !_FS_DATAWIN
+			if (fbuf_flush(fp))					/* Write-back dirty sector cache */
+				ABORT(fp->fs, FR_DISK_ERR);
+			if (fbuf_fill(fp, nsect))			/* Fill sector cache */
 				ABORT(fp->fs, FR_DISK_ERR);
 #endif
 			fp->dsect = nsect;
@@ -3040,6 +4905,9 @@ FRESULT __attribute__((section(".upper.text"))) f_lseek (
 #endif
 	}
 
+#if _FS_TINY && _FS_DATABUFS
+	fbuf_rest(fp);
+#endif
 	LEAVE_FF(fp->fs, res);
 }
 
@@ -3225,9 +5093,8 @@ FRESULT f_getfree (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD n, clst, sect, stat;
-	UINT i;
-	BYTE fat, *p;
+	DWORD n, clst, stat;
+	BYTE fat;
 
 
 	/* Get logical drive number */
@@ -3239,9 +5106,13 @@ FRESULT f_getfree (
 			*nclst = fs->free_clust;
 		} else {
 			/* Get number of free clusters */
-			fat = fs->fs_type;
+			fat = FS_TYPE(fs);
 			n = 0;
-			if (fat == FS_FAT12) {
+			if (fat == FS_FAT12
+#if !_FAT_SCAN_SECTS
+				|| FAT_RESIDENT(fs)		/* The window would see the disk copy */
+#endif
+				) {
 				clst = 2;
 				do {
 					stat = get_fat(fs, clst);
@@ -3250,6 +5121,14 @@ FRESULT f_getfree (
 					if (stat == 0) n++;
 				} while (++clst < fs->n_fatent);
 			} else {
+#if _FAT_SCAN_SECTS
+				if (fat_scan(fs, 2, fs->n_fatent, &n) == 0xFFFFFFFF)
+					res = FR_DISK_ERR;
+#else
+				DWORD sect;
+				UINT i;
+				BYTE *p;
+
 				clst = fs->n_fatent;
 				sect = fs->fatbase;
 				i = 0; p = 0;
@@ -3268,6 +5147,7 @@ FRESULT f_getfree (
 						p += 4; i -= 4;
 					}
 				} while (--clst);
+#endif
 			}
 			fs->free_clust = n;
 			fs->fsi_flag |= 1;
@@ -3301,24 +5181,40 @@ FRESULT f_truncate (
 				res = FR_DENIED;
 		}
 	}
+#if !_FS_TINY && _FS_MBUF
+	if (res == FR_OK && mbuf_sync(fp))		/* Staged sectors must not outlive the clusters */
+		res = FR_DISK_ERR;
+#endif
+#if _FS_DELALLOC
+	if (res == FR_OK)
+		res = dalloc_commit(fp);			/* The chain is cut on the FAT */
+#endif
 	if (res == FR_OK) {
 		if (fp->fsize > fp->fptr) {
 			fp->fsize = fp->fptr;	/* Set file size to current R/W point */
 			fp->flag |= FA__WRITTEN;
 			if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
-				res = remove_chain(fp->fs, fp->sclust);
+				ncl = fp->sclust;
 				fp->sclust = 0;
+#if _FS_JOURNAL
+				res = trim_entry(fp);	/* The entry lets go of the chain first */
+				if (res == FR_OK)
+#endif
+				res = remove_chain(fp->fs, ncl);
 			} else {				/* When truncate a part of the file, remove remaining clusters */
 				ncl = get_fat(fp->fs, fp->clust);
 				res = FR_OK;
 				if (ncl == 0xFFFFFFFF) res = FR_DISK_ERR;
 				if (ncl == 1) res = FR_INT_ERR;
+#if _FS_JOURNAL
+				if (res == FR_OK) res = trim_entry(fp);
+#endif
 				if (res == FR_OK && ncl < fp->fs->n_fatent) {
 					res = put_fat(fp->fs, fp->clust, 0x0FFFFFFF);
 					if (res == FR_OK) res = remove_chain(fp->fs, ncl);
 				}
 			}
-#if !_FS_TINY
+#if !_FS_DATAWIN
 			if (res == FR_OK && (fp->flag & FA__DIRTY)) {
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1))
 					res = FR_DISK_ERR;
@@ -3336,6 +5232,76 @@ FRESULT f_truncate (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Area to the File                                */
+/*-----------------------------------------------------------------------*/
+/* Gives an empty file a chain of consecutive clusters covering fsz bytes */
+/* and sets its size to fsz. Writes within it never touch the FAT. The    */
+/* free run is searched from the last allocated cluster on.               */
+
+FRESULT f_expand (
+	FIL* fp,		/* Pointer to the file object (empty, opened with FA_WRITE) */
+	DWORD fsz		/* File size to allocate (bytes) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD bcs, ncl, scl, clst, stat, n, lim;
+
+
+	res = validate(fp);						/* Check validity of the object */
+	if (res == FR_OK && fp->err) res = (FRESULT)fp->err;
+	if (res == FR_OK && (!(fp->flag & FA_WRITE) || fp->sclust || !fsz))
+		res = FR_DENIED;					/* Write mode and an empty file only */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+
+	fs = fp->fs;
+	bcs = (DWORD)SS(fs) << fs->csize_sh;	/* Cluster size (byte) */
+	ncl = (fsz / SS(fs) >> fs->csize_sh) + ((fsz & (bcs - 1)) != 0);	/* Clusters needed */
+	if (ncl > fs->n_fatent - 2) LEAVE_FF(fs, FR_DENIED);
+
+	scl = clst = (fs->last_clust >= 2 && fs->last_clust < fs->n_fatent - 1) ? fs->last_clust + 1 : 2;
+	lim = fs->n_fatent - 2 + ncl;			/* Every start point is seen once */
+	for (n = 0; ; ) {						/* Find ncl free clusters in a row */
+		stat = get_fat(fs, clst);
+		if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (stat == 1) { res = FR_INT_ERR; break; }
+#if _FS_DELALLOC || _FS_JOURNAL
+		if (stat == 0 && busy_end(fs, clst)) stat = 2;	/* Reserved by an open file or journaled */
+#endif
+		if (stat == 0) {
+			if (++n == ncl) break;			/* Found */
+		} else {
+			n = 0; scl = clst + 1;
+		}
+		if (++clst >= fs->n_fatent) {		/* A run cannot wrap around */
+			n = 0; scl = clst = 2;
+		}
+		if (!--lim) { res = FR_DENIED; break; }
+	}
+
+	for (clst = scl; res == FR_OK && clst < scl + ncl; clst++)	/* Link the chain */
+		res = put_fat(fs, clst, (clst + 1 == scl + ncl) ? 0x0FFFFFFF : clst + 1);
+
+	if (res == FR_OK) {
+		fs->last_clust = scl + ncl - 1;
+		if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSINFO */
+			fs->free_clust -= ncl;
+			fs->fsi_flag |= 1;
+		}
+		fp->sclust = scl;
+		fp->fsize = fsz;
+		fp->flag |= FA__WRITTEN | FA__NEWCHAIN;
+	} else {
+		fp->err = (FRESULT)res;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -3416,8 +5382,8 @@ FRESULT f_mkdir (
 {
 	FRESULT res;
 	DIR dj;
-	BYTE *dir, n;
-	DWORD dsc, dcl, pcl, tm = get_fattime();
+	BYTE *dir;
+	DWORD dcl, pcl, tm = get_fattime();
 	DEF_NAMEBUF;
 
 
@@ -3435,12 +5401,10 @@ FRESULT f_mkdir (
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster */
 			if (dcl == 1) res = FR_INT_ERR;
 			if (dcl == 0xFFFFFFFF) res = FR_DISK_ERR;
-			if (res == FR_OK)					/* Flush FAT */
-				res = sync_window(dj.fs);
+			if (res == FR_OK)					/* Clear the new table, window on its first sector */
+				res = dir_clear(dj.fs, dcl);
 			if (res == FR_OK) {					/* Initialize the new directory table */
-				dsc = clust2sect(dj.fs, dcl);
 				dir = dj.fs->win;
-				mem_set(dir, 0, SS(dj.fs));
 				mem_set(dir+DIR_Name, ' ', 11);	/* Create "." entry */
 				dir[DIR_Name] = '.';
 				dir[DIR_Attr] = AM_DIR;
@@ -3448,16 +5412,10 @@ FRESULT f_mkdir (
 				st_clust(dir, dcl);
 				mem_cpy(dir+SZ_DIR, dir, SZ_DIR); 	/* Create ".." entry */
 				dir[SZ_DIR+1] = '.'; pcl = dj.sclust;
-				if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
+				if (FS_TYPE(dj.fs) == FS_FAT32 && pcl == dj.fs->dirbase)
 					pcl = 0;
 				st_clust(dir+SZ_DIR, pcl);
-				for (n = dj.fs->csize; n; n--) {	/* Write dot entries and clear following sectors */
-					dj.fs->winsect = dsc++;
-					dj.fs->wflag = 1;
-					res = sync_window(dj.fs);
-					if (res != FR_OK) break;
-					mem_set(dir, 0, SS(dj.fs));
-				}
+				dj.fs->wflag = 1;				/* Dot entries go out with the window */
 			}
 			if (res == FR_OK) res = dir_register(&dj);	/* Register the object to the directoy */
 			if (res != FR_OK) {
@@ -3480,6 +5438,72 @@ FRESULT f_mkdir (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Preallocate a Directory                                               */
+/*-----------------------------------------------------------------------*/
+/* Grows the cluster chain of a directory to hold nent entries, clearing  */
+/* each new cluster with one multiple block write, so files created later */
+/* do not stretch the table. The FAT12/16 root directory is fixed; it     */
+/* only reports whether nent entries fit.                                 */
+
+FRESULT f_dirprealloc (
+	const TCHAR* path,		/* Pointer to the directory path */
+	DWORD nent				/* Number of entries the table must hold (1-65536) */
+)
+{
+	FRESULT res;
+	DIR dj;
+	DWORD clst, nxt, ncl, epc, n;
+	DEF_NAMEBUF;
+
+
+	res = find_volume(&dj.fs, &path, 1);
+	if (res == FR_OK) {
+		INIT_BUF(dj);
+		res = follow_path(&dj, path);			/* Follow the directory path */
+		FREE_BUF();
+		if (res == FR_OK && dj.dir) {			/* A sub-directory */
+			if (dj.dir[DIR_Attr] & AM_DIR)
+				dj.sclust = ld_clust(dj.fs, dj.dir);
+			else
+				res = FR_NO_PATH;
+		}
+		if (res == FR_OK && (!nent || nent > 0x10000))
+			res = FR_INVALID_PARAMETER;
+		if (res == FR_OK) {
+			clst = dj.sclust;
+			if (!clst && FS_TYPE(dj.fs) == FS_FAT32)	/* FAT32 root directory */
+				clst = dj.fs->dirbase;
+			if (!_FS_FAT32_ONLY && !clst) {		/* Static table */
+				if (nent > dj.fs->n_rootdir) res = FR_DENIED;
+			} else {
+				epc = (DWORD)(SS(dj.fs) / SZ_DIR) << dj.fs->csize_sh;	/* Entries per cluster */
+				ncl = (nent + epc - 1) / (SS(dj.fs) / SZ_DIR) >> dj.fs->csize_sh;	/* Clusters needed */
+				for (n = 1; ; n++) {			/* Find the end of the table */
+					nxt = get_fat(dj.fs, clst);
+					if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+					if (nxt < 2) { res = FR_INT_ERR; break; }
+					if (nxt >= dj.fs->n_fatent) break;
+					clst = nxt;
+				}
+				for ( ; res == FR_OK && n < ncl; n++) {	/* Stretch it */
+					clst = create_chain(dj.fs, clst);
+					if (clst == 0) res = FR_DENIED;
+					else if (clst == 1) res = FR_INT_ERR;
+					else if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
+					else res = dir_clear(dj.fs, clst);
+				}
+				if (res == FR_OK) res = sync_fs(dj.fs);
+			}
+		}
+	}
+
+	LEAVE_FF(dj.fs, res);
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Change Attribute                                                      */
 /*-----------------------------------------------------------------------*/
@@ -3619,7 +5643,7 @@ FRESULT f_rename (
 								res = move_window(djo.fs, dw);
 								dir = djo.fs->win+SZ_DIR;	/* .. entry */
 								if (res == FR_OK && dir[1] == '.') {
-									dw = (djo.fs->fs_type == FS_FAT32 && djn.sclust == djo.fs->dirbase) ? 0 : djn.sclust;
+									dw = (FS_TYPE(djo.fs) == FS_FAT32 && djn.sclust == djo.fs->dirbase) ? 0 : djn.sclust;
 									st_clust(dir, dw);
 									djo.fs->wflag = 1;
 								}
@@ -3641,6 +5665,89 @@ FRESULT f_rename (
 	LEAVE_FF(djo.fs, res);
 }
 
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Recycle a File under a New Name                                       */
+/*-----------------------------------------------------------------------*/
+/* Renames a file within its directory by rewriting the name and time     */
+/* stamps of its entry in place. Unlike f_rename(), no entry is added or  */
+/* removed, and the cluster chain and size are kept, so a preallocated    */
+/* file can be reused without touching the FAT. Only 8.3 names without   */
+/* LFN entries can be recycled.                                           */
+
+FRESULT f_recycle (
+	const TCHAR* path_old,	/* Pointer to the file to be recycled */
+	const TCHAR* path_new	/* Pointer to the new name, in the same directory */
+)
+{
+	FRESULT res;
+	DIR djo, djn;
+	BYTE *dir;
+	DWORD tm;
+	DEF_NAMEBUF;
+
+
+	res = find_volume(&djo.fs, &path_old, 1);
+	if (res == FR_OK) {
+		INIT_BUF(djo);
+		res = follow_path(&djo, path_old);		/* Check old object */
+#if _FS_LOCK
+		if (res == FR_OK) res = chk_lock(&djo, 2);
+#endif
+		if (res == FR_OK) {
+			if (!djo.dir || (djo.dir[DIR_Attr] & AM_DIR))	/* Files only */
+				res = FR_NO_FILE;
+			else if (djo.dir[DIR_Attr] & AM_RDO)
+				res = FR_DENIED;
+#if _USE_LFN
+			else if (djo.lfn_idx != 0xFFFF)		/* The LFN entries would go stale */
+				res = FR_DENIED;
+#endif
+		}
+		if (res == FR_OK) {
+			mem_cpy(&djn, &djo, sizeof (DIR));	/* Duplicate the directory object */
+			if (get_ldnumber(&path_new) >= 0)	/* Snip drive number off and ignore it */
+				res = follow_path(&djn, path_new);	/* and check if new object is exist */
+			else
+				res = FR_INVALID_DRIVE;
+			if (res == FR_OK) res = FR_EXIST;	/* The new object name is already existing */
+			if (res == FR_NO_FILE && djn.sclust != djo.sclust)
+				res = FR_INVALID_NAME;			/* Not in the same directory */
+#if _USE_LFN
+			if (res == FR_NO_FILE && (djn.fn[NS] & (NS_LOSS | NS_LFN)))
+				res = FR_INVALID_NAME;			/* The new name needs an LFN */
+#endif
+			if (res == FR_NO_FILE) {
+				res = dir_sdi(&djo, djo.index);	/* Back to the old entry */
+				if (res == FR_OK) res = move_window(djo.fs, djo.sect);
+				if (res == FR_OK) {
+					dir = djo.dir;
+					mem_cpy(dir, djn.fn, 11);	/* Put the new SFN */
+#if _USE_LFN
+					dir[DIR_NTres] = djn.fn[NS] & (NS_BODY | NS_EXT);
+#endif
+					tm = get_fattime();
+					ST_DWORD(dir+DIR_CrtTime, tm);
+					ST_DWORD(dir+DIR_WrtTime, tm);
+					ST_WORD(dir+DIR_LstAccDate, 0);
+					dir[DIR_Attr] |= AM_ARC;
+					djo.fs->wflag = 1;
+#if _USE_NUMNAME
+					numname_drop(&djn);
+#endif
+					res = sync_fs(djo.fs);
+				}
+			}
+		}
+		FREE_BUF();
+	}
+
+	LEAVE_FF(djo.fs, res);
+}
+
 #endif /* !_FS_READONLY */
 #endif /* _FS_MINIMIZE == 0 */
 #endif /* _FS_MINIMIZE <= 1 */
@@ -3703,7 +5810,7 @@ FRESULT f_getlabel (
 	if (res == FR_OK && vsn) {
 		res = move_window(dj.fs, dj.fs->volbase);
 		if (res == FR_OK) {
-			i = dj.fs->fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID;
+			i = FS_TYPE(dj.fs) == FS_FAT32 ? BS_VolID32 : BS_VolID;
 			*vsn = LD_DWORD(&dj.fs->win[i]);
 		}
 	}
@@ -3834,6 +5941,11 @@ FRESULT f_forward (
 		LEAVE_FF(fp->fs, (FRESULT)fp->err);
 	if (!(fp->flag & FA_READ))						/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
+#if _FS_DATABUFS
+	if (fbuf_flush(fp))								/* Data is read through fs->win */
+		ABORT(fp->fs, FR_DISK_ERR);
+	fp->dsect = 0;
+#endif
 
 	remain = fp->fsize - fp->fptr;
 	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
@@ -3873,7 +5985,9 @@ FRESULT f_forward (
 /* Create File System on the Drive                                       */
 /*-----------------------------------------------------------------------*/
 #define N_ROOTDIR	512		/* Number of root directory entries for FAT12/16 */
-#define N_FATS		1		/* Number of FAT copies (1 or 2) */
+#ifndef N_FATS
+#define N_FATS		1		/* Number of FAT copies (1 or 2), host tools may pass -DN_FATS=2 */
+#endif
 
 
 FRESULT f_mkfs (
@@ -3902,6 +6016,15 @@ FRESULT f_mkfs (
 	fs = FatFs[vol];
 	if (!fs) return FR_NOT_ENABLED;
 	fs->fs_type = 0;
+#if _FS_JOURNAL
+	JrnHdr.commit = JrnHdr.count = 0;	/* Images of the old volume are void */
+#endif
+#if _FS_TAIL_HINTS
+	tail_bind(LD2PD(vol), 0xFFFFFFFF, 0);	/* So are its tail hints */
+#endif
+#if _FS_FATRES
+	if (FAT_RESIDENT(fs)) FatResFs = 0;	/* So is the resident FAT */
+#endif
 	pdrv = LD2PD(vol);	/* Physical drive */
 	part = LD2PT(vol);	/* Partition (0:auto detect, 1-4:get from partition table)*/
 
@@ -3943,6 +6066,8 @@ FRESULT f_mkfs (
 	fmt = FS_FAT12;
 	if (n_clst >= MIN_FAT16) fmt = FS_FAT16;
 	if (n_clst >= MIN_FAT32) fmt = FS_FAT32;
+	if (_FS_FAT32_ONLY && fmt != FS_FAT32)	/* Could not be mounted */
+		return FR_MKFS_ABORTED;
 
 	/* Determine offset and size of FAT structure */
 	if (fmt == FS_FAT32) {
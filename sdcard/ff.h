@@ -66,6 +66,7 @@ typedef struct {
 	BYTE	fs_type;		/* FAT sub-type (0:Not mounted) */
 	BYTE	drv;			/* Physical drive number */
 	BYTE	csize;			/* Sectors per cluster (1,2,4...128) */
+	BYTE	csize_sh;		/* log2(csize), for shifts in place of multiply/divide */
 	BYTE	n_fats;			/* Number of FAT copies (1 or 2) */
 	BYTE	wflag;			/* win[] flag (b0:dirty) */
 	BYTE	fsi_flag;		/* FSINFO flags (b7:disabled, b0:dirty) */
@@ -118,8 +119,20 @@ typedef struct {
 #if _FS_LOCK
 	UINT	lockid;			/* File lock ID origin from 1 (index of file semaphore table Files[]) */
 #endif
+#if !_FS_READONLY && _FS_DELALLOC
+	DWORD	rsv_start;		/* First cluster of the run reserved for the file (0:None) */
+	DWORD	rsv_end;		/* End of the reserved run (exclusive) */
+	DWORD	rsv_tail;		/* Last linked cluster the run goes after (0:The run starts the chain) */
+#endif
 #if !_FS_TINY
 	BYTE	buf[_MAX_SS];	/* File private data read/write window */
+#if !_FS_READONLY && _FS_MBUF
+	BYTE*	mbuf;			/* Multi-sector write buffer from the pool (0:None) */
+	DWORD	msect;			/* Sector number of mbuf[0] */
+	UINT	mcnt;			/* Sectors staged in mbuf[] */
+#endif
+#elif _FS_DATABUFS
+	BYTE*	buf;			/* Data sector buffer lent from the pool (0:None) */
 #endif
 } FIL;
 
@@ -192,19 +205,25 @@ typedef enum {
 /* FatFs module application interface                           */
 
 FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode);				/* Open or create a file */
+FRESULT f_opennum (FIL* fp, const TCHAR* path, BYTE mode, DWORD* num);	/* Create the next free numbered file */
 FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);			/* Read data from a file */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to a file */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_lseek (FIL* fp, DWORD ofs);								/* Move file pointer of a file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate file */
+FRESULT f_expand (FIL* fp, DWORD fsz);								/* Allocate a contiguous area to an empty file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of a writing file */
+FRESULT f_datasync (FIL* fp);										/* Flush file data and FAT only */
+FRESULT f_recover_size (FIL* fp, UINT(*sect_len)(const BYTE*,void*), void* arg);	/* Repair file size after f_datasync() and power loss */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
 FRESULT f_mkdir (const TCHAR* path);								/* Create a sub directory */
+FRESULT f_dirprealloc (const TCHAR* path, DWORD nent);				/* Grow a directory table to hold nent entries */
 FRESULT f_unlink (const TCHAR* path);								/* Delete an existing file or directory */
 FRESULT f_rename (const TCHAR* path_old, const TCHAR* path_new);	/* Rename/Move a file or directory */
+FRESULT f_recycle (const TCHAR* path_old, const TCHAR* path_new);	/* Rename a file in place, keeping its clusters */
 FRESULT f_stat (const TCHAR* path, FILINFO* fno);					/* Get file status */
 FRESULT f_chmod (const TCHAR* path, BYTE value, BYTE mask);			/* Change attribute of the file/dir */
 FRESULT f_utime (const TCHAR* path, const FILINFO* fno);			/* Change times-tamp of the file/dir */
@@ -280,8 +299,10 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 #define	FA_CREATE_NEW		0x04
 #define	FA_CREATE_ALWAYS	0x08
 #define	FA_OPEN_ALWAYS		0x10
+#define	FA_OPEN_APPEND		0x30	/* FA_OPEN_ALWAYS with the file pointer at the end */
 #define FA__WRITTEN			0x20
 #define FA__DIRTY			0x40
+#define FA__NEWCHAIN		0x80
 #endif
 
 
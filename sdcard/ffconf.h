@@ -16,6 +16,20 @@
 /  the file system object (FATFS) instead of private sector buffer eliminated
 /  from the file object (FIL). */
 
+#define	_FS_DATABUFS	2	/* 0:Disable or 1-8:Number of shared data buffers */
+/* When _FS_TINY is 1 and _FS_DATABUFS is not 0, file data moves through a
+/  static pool of _FS_DATABUFS sector buffers instead of the common sector
+/  buffer, so file reads and writes no longer evict FAT and directory sectors.
+/  A file borrows a buffer on its first read or write and keeps it until it is
+/  closed or another file takes the least recently used one. f_forward() still
+/  uses the common sector buffer.
+/  A buffer holding no unwritten data is released when each call returns, so a
+/  file object dropped without f_close() (a read-only FIL on the stack, say) is
+/  never touched again. One that still holds unwritten data - after f_write()
+/  without f_sync(), or after an error - is written back through its FIL when
+/  another file takes the buffer, so every such FIL must be closed or synced
+/  before its storage is reused. */
+
 
 #define _FS_READONLY	0	/* 0:Read/Write or 1:Read only */
 /* Setting _FS_READONLY to 1 defines read only configuration. This removes
@@ -23,7 +37,7 @@
 /  f_rename(), f_truncate() and useless f_getfree(). */
 
 
-#define _FS_MINIMIZE	1	/* 0 to 3 */
+#define _FS_MINIMIZE	0	/* 0 to 3 */
 /* The _FS_MINIMIZE option defines minimization level to remove API functions.
 /
 /   0: All basic functions are enabled.
@@ -37,7 +51,11 @@
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
 
+#ifdef __MSP430__
 #define	_USE_MKFS		0	/* 0:Disable or 1:Enable */
+#else
+#define	_USE_MKFS		1	/* Host tools (host/) format their own images */
+#endif
 /* To enable f_mkfs() function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */
 
 
@@ -53,6 +71,105 @@
 /* To enable f_forward() function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_FS_FAT32_ONLY	0	/* 0:FAT12/16/32 or 1:FAT32 only */
+/* Setting _FS_FAT32_ONLY to 1 builds the FAT32 paths only: the FAT sub-type
+/  tests in FAT access and directory handling become constants, so the FAT12
+/  and FAT16 code and the static root directory handling are left out. Volumes
+/  that are not FAT32 fail to mount with FR_NO_FILESYSTEM. */
+
+
+#define	_FS_FATRES		128	/* 0:Disable or 1-256:Largest FAT kept resident, in sectors */
+/* When _FS_FATRES is not 0, a volume whose FAT has no more than _FS_FATRES
+/  sectors gets its primary FAT loaded into a static image at mount (in the
+/  upper FRAM on the MSP430). FAT reads and writes work on the image, and the
+/  sectors changed go to every FAT copy in multi-block runs on f_sync() or
+/  f_datasync(). 128 sectors (64 KB) cover FAT16 volumes up to 32K clusters;
+/  256 cover every FAT16 volume. Larger FATs use the sector window as before. */
+
+
+#define	_FS_MBUF		2	/* 0:Disable or 1-8:Number of pooled buffers */
+#define	_FS_MBUF_SECTS	8	/* 2-128:Sectors per buffer */
+/* When _FS_TINY is 0 and _FS_MBUF is not 0, files opened for writing take a
+/  _FS_MBUF_SECTS sector buffer from a static pool of _FS_MBUF while one is free.
+/  Sectors completed by small writes collect there and go to the disk as one
+/  multi-block write instead of one single block write each. Files opened when
+/  the pool is empty work as before. */
+
+
+#define	_FAT_SCAN_SECTS	4	/* 0:Disable or 1-16:Sectors per read */
+/* When _FAT_SCAN_SECTS is not 0, f_getfree() and the free cluster search in
+/  create_chain() read the FAT this many sectors at a time with one multi-block
+/  read into a static scratch buffer (_FAT_SCAN_SECTS * _MAX_SS bytes) and test
+/  the entries a word at a time. FAT12 volumes always use get_fat(). */
+
+
+#define	_FS_DELALLOC	16	/* 0:Disable or 2-65535:Clusters reserved per run */
+#define	_FS_DELALLOC_FILES	4	/* 1-8:Files holding a reservation at a time */
+/* When _FS_DELALLOC is not 0, a file growing past the end of its chain in
+/  f_write() reserves up to _FS_DELALLOC free clusters in a row and fills them
+/  without touching the FAT. The clusters used are linked onto the chain in one
+/  pass by f_sync(), f_datasync() and f_close(), or before f_read(), f_lseek()
+/  and f_truncate() walk the chain. Files written in turn then get runs of their
+/  own rather than alternate clusters. Other allocations skip reserved clusters,
+/  and f_getfree() still counts them as free. */
+
+
+#define	_FS_JOURNAL		16	/* 0:Disable or 4-64:Journal slots */
+/* When _FS_JOURNAL is not 0, FAT, directory and FSINFO sector updates go to a
+/  journal of _FS_JOURNAL sector images (in persistent FRAM on the MSP430)
+/  instead of the card. Each sync_fs() commits everything since the previous one
+/  with a single store, so a power cut leaves the volume as of the last commit.
+/  Batches are volume-wide, and a sync of any file commits the others' changes
+/  too, so each change journals the directory entry together with the FAT:
+/  a new chain with the entry pointing at it, a cut chain (f_truncate()) with
+/  the entry's new size and start cluster. A committed state has no leaked
+/  clusters, no chain without its entry and no entry claiming freed clusters.
+/  Committed images reach the card when half the journal is used, on unmount,
+/  or at the next mount after a power loss. Sectors journaled in order, such as
+/  the FAT runs of a large delete, go home and to each FAT copy as one
+/  multi-block write. A batch outgrowing the journal is committed early:
+/  removing a chain whose FAT entries span more than _FS_JOURNAL sectors
+/  (f_unlink(), f_truncate()) is not atomic, but as the entry is updated
+/  first, a power cut part way through only leaves the rest of the chain as
+/  lost clusters. Needs _VOLUMES 1. */
+
+
+#define	_USE_DATASYNC	1	/* 0:Disable or 1:Enable */
+/* To enable f_datasync() and f_recover_size() functions, set _USE_DATASYNC to 1.
+/  f_datasync() makes written data and the FAT durable without rewriting the
+/  directory entry and FSINFO sector. After power loss, f_recover_size() extends
+/  the file size over the sectors a length marker callback accepts. */
+
+
+#define	_FS_TAIL_HINTS	4	/* 0:Disable or 1-255:Number of hints */
+/* f_open() with FA_OPEN_APPEND needs the last cluster of the file. With
+/  _FS_TAIL_HINTS set, f_sync() remembers the last cluster of up to this many
+/  files (in persistent FRAM on the MSP430) and FA_OPEN_APPEND takes it after
+/  checking it against the FAT, instead of following the whole cluster chain.
+/  The hints are dropped when a volume with another start sector, VSN or card
+/  CID is mounted, and by f_mkfs(). */
+
+
+#define	_FS_PATHCACHE	4	/* 0:Disable or 1-16:Number of paths cached */
+/* With _FS_PATHCACHE set, the location of the directory entry found for each
+/  of the last paths followed is kept, so f_open() or f_stat() of the same path
+/  (up to 31 characters) loads one directory sector instead of searching every
+/  directory on the way. Removing a file or directory drops the volume's
+/  cached paths. */
+
+
+#define	_USE_NUMNAME	2	/* 0:Disable or 1-8:Number of directories cached */
+/* To enable f_opennum() function, set _USE_NUMNAME to the number of directory
+/  and name pattern pairs whose next free number is kept between calls. A call
+/  that misses the cache scans the directory once. */
+
+
+#define	_USE_MEMOPS		1	/* 0:Byte loops or 1:sd_memops.c */
+/* When _USE_MEMOPS is set to 1, the internal mem_cpy(), mem_set() and mem_cmp()
+/  functions are replaced with the word-wide and DMA block-transfer versions in
+/  sd_memops.c. The DMA threshold is set by SD_MEMOPS_DMA_MIN in sd_memops.h. */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
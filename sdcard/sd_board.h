@@ -0,0 +1,138 @@
+/*
+ * sd_board.h: Board traits for the SPI transport (sd_spi.h) and the card
+ * driver (diskio.c).
+ *
+ * A board is a struct of types and constants: one pin descriptor per card
+ * line, the USCI register set, the SPI mode and clock dividers, how to mask
+ * interrupts, and a free-running clock for the interrupt statistics.
+ * Registers are template parameters bound to the register objects of the
+ * device header, so every access compiles to the same absolute-address
+ * instruction a #define alias would, and drivers for two boards or two buses
+ * can be instantiated in one image.
+ *
+ * C++ only; the makefile builds every source with g++.
+ */
+#ifndef _SD_BOARD_H
+#define _SD_BOARD_H
+
+#ifndef __cplusplus
+#error sd_board.h needs C++ (build with g++)
+#endif
+
+#include <stdint.h>
+#ifdef __MSP430__
+#include <msp430fr5994.h>
+#else
+#include "sd_spi_sim.h"
+#endif
+
+template <typename T> struct sd_unvol { typedef T type; };
+template <typename T> struct sd_unvol<volatile T> { typedef T type; };
+
+/* A memory mapped register, @R being the device header's object */
+template <typename T, T &R>
+struct sd_reg {
+	typedef typename sd_unvol<T>::type value;
+	static inline value read (void) { return R; }
+	static inline void write (value v) { R = v; }
+	static inline void set (value m) { R |= m; }
+	static inline void clear (value m) { R &= (value)~m; }
+};
+
+#define SD_REG(r)	sd_reg<decltype(r), r>
+
+/* One port pin: output, direction, resistor enable and function selects */
+template <class Out, class Dir, class Ren, class Sel0, class Sel1, uint8_t Bit>
+struct sd_pin {
+	static constexpr uint8_t bit = Bit;
+	static inline void high (void) { Out::set(Bit); }
+	static inline void low (void) { Out::clear(Bit); }
+	static inline void output (void) { Dir::set(Bit); }
+	static inline void pullup (void) { Ren::set(Bit); Out::set(Bit); }
+	static inline void gpio (void) { Sel0::clear(Bit); Sel1::clear(Bit); }
+	static inline void periph (void) { Sel0::clear(Bit); Sel1::set(Bit); }	/* USCI function */
+};
+
+#define SD_PIN(port, b)	sd_pin<SD_REG(port##OUT), SD_REG(port##DIR), SD_REG(port##REN), \
+			       SD_REG(port##SEL0), SD_REG(port##SEL1), b>
+
+/* A USCI in SPI mode: registers and the status bits the transport tests */
+template <class Ctlw0, class Br0, class Br1, class Statw, class Txbuf, class Rxbuf, class Ifg,
+	  uint16_t Swrst, uint16_t Busy, uint16_t Txifg, uint16_t Rxifg>
+struct sd_usci {
+	typedef Ctlw0 ctlw0;
+	typedef Br0 br0;
+	typedef Br1 br1;
+	typedef Statw statw;
+	typedef Txbuf txbuf;
+	typedef Rxbuf rxbuf;
+	typedef Ifg ifg;
+	static constexpr uint16_t swrst = Swrst;
+	static constexpr uint16_t busy = Busy;
+	static constexpr uint16_t txifg = Txifg;
+	static constexpr uint16_t rxifg = Rxifg;
+};
+
+
+#ifdef __MSP430__
+/* MSP430FR5994 LaunchPad: card on UCB0, CS P4.0, MISO P1.7, MOSI P1.6, SCLK P2.2 */
+struct sd_board_fr5994_launchpad {
+	typedef SD_PIN(P4, BIT0) cs;
+	typedef SD_PIN(P1, BIT7) miso;
+	typedef SD_PIN(P1, BIT6) mosi;
+	typedef SD_PIN(P2, BIT2) sclk;
+	typedef SD_PIN(P7, BIT2) detect;	/* Card detect, not wired up by the driver */
+	typedef sd_usci<SD_REG(UCB0CTLW0), SD_REG(UCB0BR0), SD_REG(UCB0BR1), SD_REG(UCB0STATW),
+			SD_REG(UCB0TXBUF), SD_REG(UCB0RXBUF), SD_REG(UCB0IFG),
+			UCSWRST, UCBUSY, UCTXIFG, UCRXIFG> usci;
+	typedef SD_REG(TA0R) clock;		/* IrqStats time base, kept running by the application */
+
+	static constexpr uint16_t spi_mode = UCCKPL | UCMSB | UCMST | UCMODE_0 | UCSYNC;	/* 3-pin, 8-bit master, idle high, MSB first */
+	static constexpr uint16_t spi_clock = UCSSEL_2;		/* SMCLK */
+	static constexpr uint8_t br_slow = 64;			/* 16 MHz / 64 = 250 kHz, under 400 kHz for init */
+	static constexpr uint8_t br_fast = 1;			/* SMCLK */
+
+	static inline uint16_t irq_save (void) {
+		uint16_t gie = __get_SR_register() & GIE;
+		__disable_interrupt();
+		return gie;
+	}
+	static inline void irq_restore (uint16_t gie) { __bis_SR_register(gie); }
+};
+
+#ifndef SD_BOARD
+#define SD_BOARD	sd_board_fr5994_launchpad
+#endif
+
+#else
+/* Host: the same USCI and pins on the simulated registers of sd_spi_sim.c */
+struct sd_sim_txbuf {				/* Writing TXBUF clocks a byte through the card model */
+	typedef uint16_t value;
+	static inline void write (value v) { sd_spi_sim_xfer((uint8_t)v); }
+};
+
+struct sd_board_sim {
+	typedef SD_PIN(SimP4, SIM_CS) cs;
+	typedef SD_PIN(SimP1, SIM_MISO) miso;
+	typedef SD_PIN(SimP1, SIM_MOSI) mosi;
+	typedef SD_PIN(SimP2, SIM_SCLK) sclk;
+	typedef sd_usci<SD_REG(SimCTLW0), SD_REG(SimBR0), SD_REG(SimBR1), SD_REG(SimSTATW),
+			sd_sim_txbuf, SD_REG(SimRXBUF), SD_REG(SimIFG),
+			SIM_SWRST, SIM_BUSY, SIM_TXIFG, SIM_RXIFG> usci;
+	typedef SD_REG(SimCLOCK) clock;
+
+	static constexpr uint16_t spi_mode = 0;
+	static constexpr uint16_t spi_clock = 0;
+	static constexpr uint8_t br_slow = 64;
+	static constexpr uint8_t br_fast = 1;
+
+	static inline uint16_t irq_save (void) { return 0; }
+	static inline void irq_restore (uint16_t gie) { (void)gie; }
+};
+
+#ifndef SD_BOARD
+#define SD_BOARD	sd_board_sim
+#endif
+#endif
+
+#endif
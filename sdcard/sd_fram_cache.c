@@ -0,0 +1,171 @@
+#include "sd_fram_cache.h"
+#include "sd_memops.h"
+
+#if _USE_FCACHE
+
+// Persistent variables are initialised when the device is programmed and are
+// left alone by the C startup code, so the cache survives resets and power loss
+#ifdef __MSP430__
+#define FCACHE_PERSIST  __attribute__((persistent))
+#else
+#define FCACHE_PERSIST
+#endif
+
+// Slot n holds the sector fc_tag[n] in the buffer fc_data[fc_map[n]]. Slots
+// are filled in order, so appended data lands in neighbouring buffers and
+// destages as one multi-block write. fc_count is the commit point: a slot
+// only exists once it has been bumped. fc_map is always a permutation of all
+// but one buffer; the one left over is the shadow a committed slot is
+// rewritten into before fc_map switches to it with a single store.
+// fc_cid is the CID of the card the committed slots belong to.
+static BYTE fc_data[FCACHE_SECTORS + 1][512] FCACHE_PERSIST = {{0}};
+static DWORD fc_tag[FCACHE_SECTORS] FCACHE_PERSIST = {0};
+static volatile BYTE fc_map[FCACHE_SECTORS] FCACHE_PERSIST = {0};
+static volatile UINT fc_count FCACHE_PERSIST = 0;
+static BYTE fc_cid[16] FCACHE_PERSIST = {0};
+
+#define FC_DATA(n)  fc_data[fc_map[n]]
+
+
+// Empties the cache and lays the buffers back in slot order. Only called with
+// nothing committed, so a reset cut short is harmless and simply redone.
+static void __attribute__((section(".upper.text"))) fc_reset(void)
+{
+  fc_count = 0;
+  for (UINT n = 0; n < FCACHE_SECTORS; n++)
+    fc_map[n] = (BYTE)n;
+}
+
+
+// Returns the buffer no slot maps to
+static BYTE __attribute__((section(".upper.text"))) fc_shadow(void)
+{
+  BYTE used[FCACHE_SECTORS + 1] = {0};
+  BYTE b;
+
+  for (UINT n = 0; n < FCACHE_SECTORS; n++)
+    used[fc_map[n]] = 1;
+  for (b = 0; used[b]; b++) ;
+  return b;
+}
+
+
+// Returns the slot caching @sector, or -1. Searches newest first since FAT and
+// directory sectors are the ones rewritten over and over.
+static int __attribute__((section(".upper.text"))) fc_lookup(DWORD sector)
+{
+  for (int n = (int)fc_count - 1; n >= 0; n--) {
+    if (fc_tag[n] == sector)
+      return n;
+  }
+  return -1;
+}
+
+
+DRESULT __attribute__((section(".upper.text"))) fcache_read(BYTE *buff, DWORD sector, UINT count)
+{
+  UINT n, hits = 0;
+  int slot;
+
+  if (!fc_count)
+    return mmc_disk_read(buff, sector, count);
+
+  for (n = 0; n < count; n++) {
+    if (fc_lookup(sector + n) >= 0)
+      hits++;
+  }
+
+  // Partial hit: read the whole range in one go, then lay the dirty sectors on top
+  if (hits < count) {
+    DRESULT res = mmc_disk_read(buff, sector, count);
+    if (res != RES_OK)
+      return res;
+  }
+  for (n = 0; hits && n < count; n++) {
+    slot = fc_lookup(sector + n);
+    if (slot >= 0) {
+      sd_mem_cpy(buff + n * 512, FC_DATA(slot), 512);
+      hits--;
+    }
+  }
+
+  return RES_OK;
+}
+
+
+DRESULT __attribute__((section(".upper.text"))) fcache_write(const BYTE *buff, DWORD sector, UINT count)
+{
+  DRESULT res;
+  int slot;
+
+  if (count >= FCACHE_BYPASS) {
+    res = fcache_flush();
+    return res != RES_OK ? res : mmc_disk_write(buff, sector, count);
+  }
+
+  for (; count; count--, sector++, buff += 512) {
+    slot = fc_lookup(sector);
+    if (slot < 0) {
+      if (fc_count == FCACHE_SECTORS) {
+        res = fcache_flush();
+        if (res != RES_OK)
+          return res;
+      }
+      slot = fc_count;
+      sd_mem_cpy(FC_DATA(slot), buff, 512);
+      fc_tag[slot] = sector;
+      fc_count = slot + 1;                        // Commit the new slot
+    } else {
+      BYTE b = fc_shadow();                       // Never torn: the old image stays
+      sd_mem_cpy(fc_data[b], buff, 512);          // live until the switch below
+      fc_map[slot] = b;
+    }
+  }
+
+  return RES_OK;
+}
+
+
+DRESULT __attribute__((section(".upper.text"))) fcache_flush(void)
+{
+  UINT n = 0, run, total = fc_count;
+  DRESULT res;
+
+  while (n < total) {
+    for (run = 1; n + run < total && fc_tag[n + run] == fc_tag[n] + run
+                  && fc_map[n + run] == fc_map[n] + run; run++) ;
+    res = mmc_disk_write(FC_DATA(n), fc_tag[n], run);
+    if (res != RES_OK)
+      return res;
+    n += run;
+  }
+  fc_reset();
+
+  return RES_OK;
+}
+
+
+DRESULT __attribute__((section(".upper.text"))) fcache_attach(const BYTE *cid)
+{
+  DRESULT res = RES_OK;
+
+  if (fc_count) {
+    if (sd_mem_cmp(fc_cid, cid, sizeof fc_cid) == 0)
+      res = fcache_flush();                       // Same card: replay
+    else
+      fc_reset();                                 // Another card, or this one edited elsewhere
+  } else {
+    fc_reset();                                   // Also lays out a freshly programmed fc_map
+  }
+  if (res == RES_OK)
+    sd_mem_cpy(fc_cid, cid, sizeof fc_cid);       // Nothing committed, so not torn
+  return res;
+}
+
+
+UINT __attribute__((section(".upper.text"))) fcache_pending(void)
+{
+  return fc_count;
+}
+
+#endif /* _USE_FCACHE */
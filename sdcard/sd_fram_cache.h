@@ -0,0 +1,86 @@
+/*
+ * sd_fram_cache.h: Non-volatile write-back sector cache kept in FRAM, sitting
+ * between FatFs (disk_read/disk_write) and the SPI card driver in diskio.c.
+ *
+ * A sector written through the cache is durable as soon as disk_write()
+ * returns, because FRAM keeps it across power loss. The card only sees the
+ * cached sectors when the cache fills, when fcache_flush() is called, or when
+ * disk_initialize() replays what a previous power cycle left behind. The
+ * cache remembers which card it holds sectors for, so nothing is replayed
+ * onto a different card.
+ */
+#ifndef _SD_FRAM_CACHE_H
+#define _SD_FRAM_CACHE_H
+
+#include "integer.h"
+#include "diskio.h"
+
+/* Number of 512 byte sectors held in FRAM. Each one costs 517 bytes of
+ * persistent FRAM (data + tag + map), plus one 512 byte shadow buffer. */
+#ifndef FCACHE_SECTORS
+#define FCACHE_SECTORS      32
+#endif
+
+/* Writes of at least this many sectors bypass the cache: it is flushed first
+ * so older cached copies cannot land on top of the new data, then the
+ * request goes straight to the card as one multi-block write. */
+#ifndef FCACHE_BYPASS
+#define FCACHE_BYPASS       FCACHE_SECTORS
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * fcache_read(): Reads sectors, taking the cached copy of any that are dirty
+ * @buff:    Destination, @count * 512 bytes
+ * @sector:  Start sector number (LBA)
+ * @count:   Sector count
+ *
+ * Sectors not in the cache are read from the card in one multi-block read.
+ */
+DRESULT fcache_read(BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * fcache_write(): Writes sectors into the FRAM cache
+ * @buff:    Source, @count * 512 bytes
+ * @sector:  Start sector number (LBA)
+ * @count:   Sector count
+ *
+ * A sector already in the cache is rewritten into the shadow buffer and
+ * switched in with one store, so power loss leaves the old or the new image,
+ * never a mix. Otherwise it takes the next free slot. A full cache is
+ * destaged to the card first.
+ */
+DRESULT fcache_write(const BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * fcache_flush(): Destages every cached sector to the card
+ *
+ * Runs of slots holding consecutive sectors go out as one multi-block write.
+ * The cache is emptied only after every run has been accepted by the card,
+ * so a flush cut short by power loss is simply repeated on the next boot.
+ */
+DRESULT fcache_flush(void);
+
+/**
+ * fcache_attach(): Ties the cache to the card just initialized
+ * @cid:  The card's 16 byte CID (MMC_GET_CID)
+ *
+ * Sectors left by the last power cycle are replayed if they belong to this
+ * card and discarded if they do not: a card swapped while the system was off
+ * must not receive another card's sectors. Called by disk_initialize().
+ */
+DRESULT fcache_attach(const BYTE *cid);
+
+/**
+ * fcache_pending(): Returns the number of sectors waiting to be destaged
+ */
+UINT fcache_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
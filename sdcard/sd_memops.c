@@ -0,0 +1,182 @@
+#include "sd_memops.h"
+#include "sd_place.h"
+#include <stdint.h>
+#ifdef __MSP430__
+#include <msp430fr5994.h>
+#endif
+
+// Both pointers share word alignment, so the bulk of the block can move as words
+#define SAME_PARITY(a, b)   ((((uintptr_t)(a) ^ (uintptr_t)(b)) & 1) == 0)
+#define IS_ODD(a)           (((uintptr_t)(a) & 1) != 0)
+
+
+#if SD_MEMOPS_USE_DMA
+/*
+ * Runs @n transfers on DMA channel 0 with the software (DMAREQ) trigger, in
+ * blocks of at most SD_MEMOPS_DMA_CHUNK. The CPU is held while each block
+ * moves, so the caller sees the data in place on return, and interrupts are
+ * serviced between blocks.
+ */
+static void __attribute__((section(".upper.text"))) dma_block(const void *src, void *dst, unsigned int n, uint16_t ctl)
+{
+  const uint8_t *s = (const uint8_t *)src;
+  uint8_t *d = (uint8_t *)dst;
+  unsigned int step = (ctl & DMADSTBYTE) ? 1 : 2; // Bytes per transfer
+
+  DMACTL0 &= ~0x001F;                             // DMA0TSELx = 0: DMAREQ trigger
+  while (n) {
+    unsigned int k = n < SD_MEMOPS_DMA_CHUNK ? n : SD_MEMOPS_DMA_CHUNK;
+
+    __data16_write_addr((unsigned short)(uintptr_t)&DMA0SA, (unsigned long)(uintptr_t)s);
+    __data16_write_addr((unsigned short)(uintptr_t)&DMA0DA, (unsigned long)(uintptr_t)d);
+    DMA0SZ = k;
+    DMA0CTL = DMADT_1 | ctl | DMAEN;              // Block transfer
+    DMA0CTL |= DMAREQ;                            // Start, CPU resumes when done
+    if ((ctl & DMASRCINCR_3) == DMASRCINCR_3)     // Fixed sources (fills) stay put
+      s += k * step;
+    d += k * step;
+    n -= k;
+  }
+}
+#endif
+
+
+// The word loops and sd_mem_cmp() run from SRAM (sd_place.h). The DMA paths
+// stay in FRAM: once started, the transfer does not depend on code fetches.
+void SD_RAMFUNC sd_mem_cpy_word(void *dst, const void *src, unsigned int cnt)
+{
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+
+  if (cnt >= 4 && SAME_PARITY(d, s)) {
+    if (IS_ODD(d)) {
+      *d++ = *s++;
+      cnt--;
+    }
+    uint16_t *dw = (uint16_t *)d;
+    const uint16_t *sw = (const uint16_t *)s;
+    for (unsigned int n = cnt >> 1; n; n--)
+      *dw++ = *sw++;
+    d = (uint8_t *)dw;
+    s = (const uint8_t *)sw;
+    cnt &= 1;
+  }
+  while (cnt--)
+    *d++ = *s++;
+}
+
+
+void __attribute__((section(".upper.text"))) sd_mem_cpy_dma(void *dst, const void *src, unsigned int cnt)
+{
+#if SD_MEMOPS_USE_DMA
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+
+  if (!cnt)
+    return;
+  if (!SAME_PARITY(d, s)) {                       // Misaligned pair: byte transfers
+    dma_block(s, d, cnt, DMASRCINCR_3 | DMADSTINCR_3 | DMASRCBYTE | DMADSTBYTE);
+    return;
+  }
+  if (IS_ODD(d)) {
+    *d++ = *s++;
+    cnt--;
+  }
+  if (cnt >> 1)
+    dma_block(s, d, cnt >> 1, DMASRCINCR_3 | DMADSTINCR_3);
+  if (cnt & 1)
+    d[cnt - 1] = s[cnt - 1];
+#else
+  sd_mem_cpy_word(dst, src, cnt);
+#endif
+}
+
+
+void __attribute__((section(".upper.text"))) sd_mem_cpy(void *dst, const void *src, unsigned int cnt)
+{
+  if (SD_MEMOPS_USE_DMA && cnt >= SD_MEMOPS_DMA_MIN)
+    sd_mem_cpy_dma(dst, src, cnt);
+  else
+    sd_mem_cpy_word(dst, src, cnt);
+}
+
+
+void SD_RAMFUNC sd_mem_set_word(void *dst, int val, unsigned int cnt)
+{
+  uint8_t *d = (uint8_t *)dst;
+  uint8_t v = (uint8_t)val;
+
+  if (cnt >= 4) {
+    if (IS_ODD(d)) {
+      *d++ = v;
+      cnt--;
+    }
+    uint16_t *dw = (uint16_t *)d;
+    uint16_t pat = (uint16_t)(v | (v << 8));
+    for (unsigned int n = cnt >> 1; n; n--)
+      *dw++ = pat;
+    d = (uint8_t *)dw;
+    cnt &= 1;
+  }
+  while (cnt--)
+    *d++ = v;
+}
+
+
+void __attribute__((section(".upper.text"))) sd_mem_set_dma(void *dst, int val, unsigned int cnt)
+{
+#if SD_MEMOPS_USE_DMA
+  uint8_t *d = (uint8_t *)dst;
+  uint8_t v = (uint8_t)val;
+  uint16_t pat = (uint16_t)(v | (v << 8));        // Fixed source for the transfer
+
+  if (!cnt)
+    return;
+  if (IS_ODD(d)) {
+    *d++ = v;
+    cnt--;
+  }
+  if (cnt >> 1)
+    dma_block(&pat, d, cnt >> 1, DMASRCINCR_0 | DMADSTINCR_3);
+  if (cnt & 1)
+    d[cnt - 1] = v;
+#else
+  sd_mem_set_word(dst, val, cnt);
+#endif
+}
+
+
+void __attribute__((section(".upper.text"))) sd_mem_set(void *dst, int val, unsigned int cnt)
+{
+  if (SD_MEMOPS_USE_DMA && cnt >= SD_MEMOPS_DMA_MIN)
+    sd_mem_set_dma(dst, val, cnt);
+  else
+    sd_mem_set_word(dst, val, cnt);
+}
+
+
+int SD_RAMFUNC sd_mem_cmp(const void *a, const void *b, unsigned int cnt)
+{
+  const uint8_t *pa = (const uint8_t *)a, *pb = (const uint8_t *)b;
+
+  // DMA cannot compare, so only the word path exists. A mismatching word
+  // drops through to the byte loop to produce the sign of the first byte.
+  if (cnt >= 4 && SAME_PARITY(pa, pb)) {
+    if (IS_ODD(pa)) {
+      if (*pa != *pb)
+        return *pa - *pb;
+      pa++; pb++; cnt--;
+    }
+    const uint16_t *wa = (const uint16_t *)pa, *wb = (const uint16_t *)pb;
+    while (cnt >= 2 && *wa == *wb) {
+      wa++; wb++;
+      cnt -= 2;
+    }
+    pa = (const uint8_t *)wa;
+    pb = (const uint8_t *)wb;
+  }
+
+  int r = 0;
+  while (cnt-- && (r = *pa++ - *pb++) == 0) ;
+  return r;
+}
@@ -0,0 +1,78 @@
+/*
+ * sd_memops.h: Word-wide and DMA block-transfer memory operations used by the
+ * sd card stack (FatFs mem_cpy/mem_set/mem_cmp) and by dev_clear_memory().
+ */
+#ifndef _SD_MEMOPS_H
+#define _SD_MEMOPS_H
+
+#include <stdint.h>
+
+/* Transfers of at least this many bytes are handed to the DMA controller.
+ * Below it the DMA setup costs more than the word loop it replaces. */
+#ifndef SD_MEMOPS_DMA_MIN
+#define SD_MEMOPS_DMA_MIN   64
+#endif
+
+/* Largest DMA block, in transfers. The CPU is halted while a block moves
+ * and interrupts wait for it to finish, so long copies are split and any
+ * pending interrupt is taken between blocks (about 2 cycles per transfer). */
+#ifndef SD_MEMOPS_DMA_CHUNK
+#define SD_MEMOPS_DMA_CHUNK 64
+#endif
+
+/* Set to 0 to build the word-wide paths only (e.g. when DMA channel 0 is
+ * owned by a peripheral driver). Hosts never use DMA. */
+#ifndef SD_MEMOPS_USE_DMA
+#ifdef __MSP430__
+#define SD_MEMOPS_USE_DMA   1
+#else
+#define SD_MEMOPS_USE_DMA   0
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * sd_mem_cpy(): Copies @cnt bytes from @src to @dst (regions must not overlap)
+ * @dst:  Destination address
+ * @src:  Source address
+ * @cnt:  Number of bytes to copy
+ *
+ * Picks the DMA path for transfers of SD_MEMOPS_DMA_MIN bytes or more and the
+ * word-wide path otherwise.
+ */
+void sd_mem_cpy(void *dst, const void *src, unsigned int cnt);
+
+/**
+ * sd_mem_set(): Fills @cnt bytes at @dst with the low byte of @val
+ * @dst:  Destination address
+ * @val:  Fill value
+ * @cnt:  Number of bytes to fill
+ */
+void sd_mem_set(void *dst, int val, unsigned int cnt);
+
+/**
+ * sd_mem_cmp(): Compares @cnt bytes at @a and @b
+ * @a:    First block
+ * @b:    Second block
+ * @cnt:  Number of bytes to compare
+ *
+ * Returns the difference of the first mismatching bytes, 0 when equal.
+ */
+int sd_mem_cmp(const void *a, const void *b, unsigned int cnt);
+
+/* Fixed-path variants, exposed for benchmarking and for callers that know
+ * their transfer size up front. The _dma variants fall back to the word
+ * path when SD_MEMOPS_USE_DMA is 0. */
+void sd_mem_cpy_word(void *dst, const void *src, unsigned int cnt);
+void sd_mem_cpy_dma(void *dst, const void *src, unsigned int cnt);
+void sd_mem_set_word(void *dst, int val, unsigned int cnt);
+void sd_mem_set_dma(void *dst, int val, unsigned int cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * sd_place.h: Code and buffer placement for the sd card stack.
+ *
+ * On the FR5994 everything runs from FRAM by default, and above 8 MHz FRAM
+ * needs a wait state (FRCTL0 NWAITS_1 at 16 MHz). The cache in front of it
+ * hides most of that for straight-line code, but the loops that clock every
+ * byte of a sector through the SPI port miss it often enough to run slower
+ * than the USCI. SRAM never waits, so the placement policy is:
+ *
+ *  - Loops that touch every byte of every sector (the SPI byte and block
+ *    routines in diskio.c, the word loops in sd_memops.c) are SD_RAMFUNC.
+ *    They are linked to run in SRAM and loaded into FRAM as part of .data,
+ *    which the C startup code (crt0) copies to SRAM before main().
+ *  - Sector buffers that those loops fill on ordinary file reads and writes
+ *    (the FATFS window, which the application declares, and the shared data
+ *    buffers) are SD_SRAM_BSS.
+ *  - Large or rarely used buffers (the resident FAT image, the FAT scan and
+ *    FSINFO buffers, the multi-sector pool) are SD_FRAM_BSS, in the upper
+ *    FRAM. State that has to survive a reset stays __attribute__((persistent)).
+ *
+ * SRAM is 8 KB and also holds the stack, so only buffers on the per-sector
+ * path belong there. Build with SD_PLACE_RAMFUNC 0 to run everything from
+ * FRAM again, e.g. to compare with dev_bench_spi_block().
+ */
+#ifndef _SD_PLACE_H
+#define _SD_PLACE_H
+
+#ifndef SD_PLACE_RAMFUNC
+#ifdef __MSP430__
+#define SD_PLACE_RAMFUNC    1
+#else
+#define SD_PLACE_RAMFUNC    0
+#endif
+#endif
+
+#if SD_PLACE_RAMFUNC
+#define SD_RAMFUNC      __attribute__((section(".data.sd_ramfunc")))
+#else
+#define SD_RAMFUNC      __attribute__((section(".upper.text")))
+#endif
+
+#ifdef __MSP430__
+#define SD_SRAM_BSS     __attribute__((section(".bss.sd_sram")))
+#define SD_FRAM_BSS     __attribute__((section(".upper.bss")))
+#else
+#define SD_SRAM_BSS
+#define SD_FRAM_BSS
+#endif
+
+#endif
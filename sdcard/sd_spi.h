@@ -0,0 +1,119 @@
+/*
+ * sd_spi.h: SPI transport to the card, templated on the board traits in
+ * sd_board.h.
+ *
+ * Everything here is inline, so sd_spi<Board>::xmit() in a caller compiles
+ * to the register accesses of that board and nothing else.
+ *
+ * As master the USCI only clocks when TXBUF is written, so an interrupt
+ * taken between the steps of a byte exchange stretches the gap between
+ * bytes and nothing else. With _SPI_IRQ_OPEN (diskio.h) interrupts stay
+ * enabled throughout; otherwise they are masked for each byte and, with
+ * _USE_IRQSTATS, the longest masked window goes to IrqStats.max_off.
+ */
+#ifndef _SD_SPI_H
+#define _SD_SPI_H
+
+#include "integer.h"
+#include "diskio.h"
+#include "sd_board.h"
+
+template <class Board>
+struct sd_spi {
+	typedef typename Board::usci usci;
+
+	/* Pins to the USCI, CS high, and the USCI started as master at the slow clock */
+	static inline void init (void) {
+		Board::sclk::periph();
+		Board::miso::periph();
+		Board::mosi::periph();
+		Board::sclk::output();
+		Board::mosi::output();
+
+		Board::cs::gpio();
+		Board::cs::high();
+		Board::cs::output();
+
+		Board::miso::pullup();
+		Board::mosi::pullup();
+
+		usci::ctlw0::write(usci::swrst);		/* Put state machine in reset */
+		usci::ctlw0::set(Board::spi_mode | Board::spi_clock);
+		usci::br0::write(Board::br_slow);		/* Initial SPI clock must be <400kHz */
+		usci::br1::write(0);
+		usci::ctlw0::clear(usci::swrst);		/* Release USCI state machine */
+		usci::ifg::clear(usci::rxifg);
+	}
+
+	/* Changes the bit clock divider */
+	static inline void set_divider (uint16_t br) {
+		usci::ctlw0::set(usci::swrst);
+		usci::br0::write((uint8_t)br);
+		usci::br1::write((uint8_t)(br >> 8));
+		usci::ctlw0::clear(usci::swrst);
+	}
+
+	static inline void select (void) { Board::cs::low(); }		/* CS = L */
+	static inline void deselect (void) { Board::cs::high(); }	/* CS = H */
+
+#if _SPI_IRQ_OPEN
+	static inline uint16_t irq_off (void) { return 0; }
+	static inline void irq_on (uint16_t gie) { (void)gie; }
+#else
+	/* Masks interrupts for one byte exchange, noting when if they were enabled */
+	static inline uint16_t irq_off (void) {
+		uint16_t gie = Board::irq_save();
+#if _USE_IRQSTATS
+		if (gie) off_since = Board::clock::read();
+#endif
+		return gie;
+	}
+
+	static inline void irq_on (uint16_t gie) {
+#if _USE_IRQSTATS
+		if (gie) {
+			uint16_t t = Board::clock::read() - off_since;
+			if (t > IrqStats.max_off) IrqStats.max_off = t;
+		}
+#endif
+		Board::irq_restore(gie);
+	}
+
+#if _USE_IRQSTATS
+	static uint16_t off_since;			/* Board clock when interrupts were masked */
+#endif
+#endif
+
+	/* Transmit a byte, discarding what comes back */
+	static inline void xmit (BYTE dat) {
+		uint16_t gie = irq_off();
+
+		while (!(usci::ifg::read() & usci::txifg)) ;	/* Wait for TX ready */
+		usci::txbuf::write(dat);
+		while (usci::statw::read() & usci::busy) ;
+		usci::rxbuf::read();				/* Empty RX buffer, clear any overrun */
+
+		irq_on(gie);
+	}
+
+	/* Receive a byte, clocking out 0xFF */
+	static inline BYTE rcvr (void) {
+		BYTE dat;
+		uint16_t gie = irq_off();
+
+		usci::ifg::clear(usci::rxifg);			/* Ensure RXIFG clear */
+		while (!(usci::ifg::read() & usci::txifg)) ;	/* Wait for TX ready */
+		usci::txbuf::write(0xFF);			/* Send dummy byte */
+		while (!(usci::ifg::read() & usci::rxifg)) ;	/* Wait for RX buffer */
+		dat = (BYTE)usci::rxbuf::read();
+
+		irq_on(gie);
+		return dat;
+	}
+};
+
+#if !_SPI_IRQ_OPEN && _USE_IRQSTATS
+template <class Board> uint16_t sd_spi<Board>::off_since;
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+/*-----------------------------------------------------------------------*/
+/* Simulated SPI bus for host builds of the card driver                  */
+/*-----------------------------------------------------------------------*/
+/* Backs the registers of sd_board_sim (sd_board.h), so diskio.c can run  */
+/* on a PC against a card model instead of a LaunchPad. Not built for the */
+/* MSP430.                                                                */
+/*-----------------------------------------------------------------------*/
+
+#ifndef __MSP430__
+
+#include <stddef.h>
+#include "./sd_spi_sim.h"
+
+volatile uint16_t SimCTLW0 = SIM_SWRST, SimSTATW, SimRXBUF, SimIFG = SIM_TXIFG;
+volatile uint16_t SimCLOCK;
+volatile uint8_t SimBR0, SimBR1;
+volatile uint8_t SimP1OUT, SimP1DIR, SimP1REN, SimP1SEL0, SimP1SEL1;
+volatile uint8_t SimP2OUT, SimP2DIR, SimP2REN, SimP2SEL0, SimP2SEL1;
+volatile uint8_t SimP4OUT, SimP4DIR, SimP4REN, SimP4SEL0, SimP4SEL1;
+
+static uint8_t (*Card)(uint8_t tx, int selected);	/* Card model, NULL: empty socket */
+
+
+void sd_spi_sim_attach (
+    uint8_t (*card)(uint8_t tx, int selected)	/* Card model */
+){
+	Card = card;
+}
+
+
+void sd_spi_sim_xfer (
+    uint8_t tx					/* Byte written to TXBUF */
+){
+	int selected = (SimP4DIR & SIM_CS) && !(SimP4OUT & SIM_CS);
+
+	SimRXBUF = Card ? Card(tx, selected) : 0xFF;
+	SimCLOCK += SIM_BYTE_TICKS;
+	SimIFG |= SIM_RXIFG | SIM_TXIFG;
+}
+
+#endif /* __MSP430__ */
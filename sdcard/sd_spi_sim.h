@@ -0,0 +1,57 @@
+/*
+ * sd_spi_sim.h: Simulated USCI and port registers for host builds of the SPI
+ * transport and card driver (sd_board_sim in sd_board.h).
+ *
+ * Every byte written to SimTXBUF is exchanged with a card model supplied by
+ * the caller, and the card's reply lands in SimRXBUF. With no model attached
+ * the bus reads 0xFF, as an empty socket does. Not built for the MSP430.
+ */
+#ifndef _SD_SPI_SIM_H
+#define _SD_SPI_SIM_H
+
+#include <stdint.h>
+
+/* Bits of the simulated registers, laid out as on the USCI */
+#define SIM_SWRST   0x0001      /* SimCTLW0 */
+#define SIM_BUSY    0x0001      /* SimSTATW */
+#define SIM_RXIFG   0x0001      /* SimIFG */
+#define SIM_TXIFG   0x0002      /* SimIFG */
+#define SIM_CS      0x01        /* SimP4 */
+#define SIM_MOSI    0x40        /* SimP1 */
+#define SIM_MISO    0x80        /* SimP1 */
+#define SIM_SCLK    0x04        /* SimP2 */
+
+#define SIM_BYTE_TICKS  16      /* SimCLOCK ticks per byte, 8 bit clocks at SMCLK / 2 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile uint16_t SimCTLW0, SimSTATW, SimRXBUF, SimIFG;
+extern volatile uint16_t SimCLOCK;     /* Advances SIM_BYTE_TICKS per byte clocked */
+extern volatile uint8_t SimBR0, SimBR1;
+extern volatile uint8_t SimP1OUT, SimP1DIR, SimP1REN, SimP1SEL0, SimP1SEL1;
+extern volatile uint8_t SimP2OUT, SimP2DIR, SimP2REN, SimP2SEL0, SimP2SEL1;
+extern volatile uint8_t SimP4OUT, SimP4DIR, SimP4REN, SimP4SEL0, SimP4SEL1;
+
+/**
+ * sd_spi_sim_attach(): Plugs a card model into the simulated bus
+ * @card:  Called once per byte clocked with the byte sent and whether CS is
+ *         low, returns the byte the card sends back. NULL detaches.
+ */
+void sd_spi_sim_attach(uint8_t (*card)(uint8_t tx, int selected));
+
+/**
+ * sd_spi_sim_xfer(): Clocks one byte through the bus
+ * @tx:  Byte written to SimTXBUF
+ *
+ * Called by the transport's TXBUF descriptor. Sets SimRXBUF to the reply and
+ * raises SIM_RXIFG; SIM_TXIFG stays set, so the transport never waits.
+ */
+void sd_spi_sim_xfer(uint8_t tx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,158 @@
+#include "dvz.h"
+#include "reclog.h"
+#include <stddef.h>
+#include <string.h>
+
+#define HDR_SIZE      sizeof(struct dvz_hdr)
+#define MAX_VARINT    3                           // 16 bits in 7 bit groups
+
+
+// Zig-zag maps 0, -1, 1, -2 ... to 0, 1, 2, 3 ... so small steps either way stay short
+static inline uint16_t zigzag(int16_t d)
+{
+  return (uint16_t)(((uint16_t)d << 1) ^ (uint16_t)(d >> 15));
+}
+
+
+static inline int16_t unzigzag(uint16_t z)
+{
+  return (int16_t)((z >> 1) ^ (uint16_t)-(int16_t)(z & 1));
+}
+
+
+static uint16_t __attribute__((section(".upper.text"))) block_crc(const union dvz_block *blk)
+{
+  static const uint16_t zero = 0;
+  uint16_t crc;
+
+  crc = reclog_crc16(0xFFFF, blk->b, offsetof(struct dvz_hdr, crc));
+  crc = reclog_crc16(crc, &zero, sizeof zero);
+  return reclog_crc16(crc, blk->b + HDR_SIZE, DVZ_BLOCK - HDR_SIZE);
+}
+
+
+static void __attribute__((section(".upper.text"))) start_block(struct dvz_enc *enc)
+{
+  memset(enc->blk.b, 0, DVZ_BLOCK);
+  enc->blk.h.magic = DVZ_MAGIC;
+  enc->blk.h.channels = enc->channels;
+  enc->blk.h.version = DVZ_VERSION;
+  memset(enc->prev, 0, sizeof enc->prev);
+  enc->pos = HDR_SIZE;
+}
+
+
+// Writes the block image at the file pointer
+static FRESULT __attribute__((section(".upper.text"))) put_block(struct dvz_enc *enc)
+{
+  FRESULT res;
+  UINT bw;
+
+  if (!enc->fp)
+    return FR_OK;
+  enc->blk.h.crc = block_crc(&enc->blk);
+  res = f_write(enc->fp, enc->blk.b, DVZ_BLOCK, &bw);
+  if (res == FR_OK && bw != DVZ_BLOCK)
+    res = FR_DENIED;                              // Volume full
+  return res;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) dvz_init(struct dvz_enc *enc, FIL *fp, uint8_t channels)
+{
+  if (!channels || channels > DVZ_MAX_CHANNELS || (fp && f_tell(fp) % DVZ_BLOCK))
+    return FR_INVALID_PARAMETER;
+
+  enc->fp = fp;
+  enc->channels = channels;
+  enc->raw_bytes = 0;
+  enc->out_bytes = 0;
+  start_block(enc);
+  return FR_OK;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) dvz_put(struct dvz_enc *enc, const int16_t *frame)
+{
+  FRESULT res;
+  uint8_t *p;
+  uint16_t z;
+
+  // Worst case is checked up front so a frame never straddles two blocks
+  if (enc->pos + enc->channels * MAX_VARINT > DVZ_BLOCK) {
+    res = put_block(enc);
+    if (res != FR_OK)
+      return res;
+    enc->out_bytes += DVZ_BLOCK;
+    start_block(enc);
+  }
+
+  p = enc->blk.b + enc->pos;
+  for (uint8_t c = 0; c < enc->channels; c++) {
+    z = zigzag((int16_t)(frame[c] - enc->prev[c]));
+    enc->prev[c] = frame[c];
+    while (z >= 0x80) {
+      *p++ = (uint8_t)(z | 0x80);
+      z >>= 7;
+    }
+    *p++ = (uint8_t)z;
+  }
+  enc->pos = (uint16_t)(p - enc->blk.b);
+  enc->blk.h.frames++;
+  enc->raw_bytes += enc->channels * sizeof(int16_t);
+
+  return FR_OK;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) dvz_flush(struct dvz_enc *enc)
+{
+  FRESULT res;
+
+  if (!enc->fp)
+    return FR_OK;
+  if (!enc->blk.h.frames)
+    return f_sync(enc->fp);
+
+  res = put_block(enc);
+  if (res == FR_OK)
+    res = f_sync(enc->fp);
+  if (res == FR_OK)                               // Later frames complete this block in place
+    res = f_lseek(enc->fp, f_tell(enc->fp) - DVZ_BLOCK);
+  return res;
+}
+
+
+int __attribute__((section(".upper.text"))) dvz_decode_block(const void *blk, int16_t *out, uint16_t max_frames, uint8_t *channels)
+{
+  const union dvz_block *b = (const union dvz_block *)blk;
+  const uint8_t *p = b->b + HDR_SIZE, *end = b->b + DVZ_BLOCK;
+  int16_t prev[DVZ_MAX_CHANNELS] = {0};
+  uint8_t ch = b->h.channels;
+  uint16_t z;
+
+  if (b->h.magic != DVZ_MAGIC || b->h.version != DVZ_VERSION)
+    return -1;
+  if (!ch || ch > DVZ_MAX_CHANNELS || b->h.frames > max_frames)
+    return -1;
+  if (b->h.crc != block_crc(b))
+    return -1;
+
+  for (uint16_t f = 0; f < b->h.frames; f++) {
+    for (uint8_t c = 0; c < ch; c++) {
+      z = 0;
+      for (uint8_t shift = 0; ; shift += 7) {
+        if (p == end || shift > 14)
+          return -1;
+        z |= (uint16_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+          break;
+      }
+      prev[c] = (int16_t)(prev[c] + unzigzag(z));
+      *out++ = prev[c];
+    }
+  }
+
+  *channels = ch;
+  return b->h.frames;
+}
@@ -0,0 +1,99 @@
+/*
+ * dvz.h: Streaming delta + zig-zag varint compressor for 16 bit sample frames.
+ *
+ * A frame is one signed 16 bit sample per channel. Each sample is stored as
+ * the difference from the same channel's previous sample, zig-zag mapped so
+ * small negative steps stay small, then written as a 1 to 3 byte varint.
+ * Slowly changing channels come out at about one byte per sample.
+ *
+ * Output is cut into 512 byte blocks that line up with the file's sectors.
+ * The predictor restarts at zero in every block, so each block decodes on its
+ * own: a reader can seek to any sector, and a torn block (bad CRC) costs only
+ * that block. The encoder needs one block of RAM plus the previous frame.
+ *
+ * dvz_decode_block() is plain C with no MSP430 dependencies, so the same file
+ * serves as the host-side decoder.
+ */
+#ifndef _DVZ_H
+#define _DVZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../sdcard/ff.h"
+
+#define DVZ_BLOCK           512
+#define DVZ_MAGIC           0x5A44      /* "DZ" */
+#define DVZ_VERSION         1
+#define DVZ_MAX_CHANNELS    16
+
+struct dvz_hdr {
+  uint16_t magic;               /* DVZ_MAGIC */
+  uint8_t channels;             /* samples per frame */
+  uint8_t version;              /* DVZ_VERSION */
+  uint16_t frames;              /* frames encoded in this block */
+  uint16_t crc;                 /* reclog_crc16() of the block with this field zero */
+};
+
+union dvz_block {
+  struct dvz_hdr h;
+  uint8_t b[DVZ_BLOCK];
+};
+
+struct dvz_enc {
+  FIL *fp;                      /* output file, NULL to only count (benchmarks) */
+  uint8_t channels;             /* samples per frame */
+  uint16_t pos;                 /* next free byte in blk */
+  int16_t prev[DVZ_MAX_CHANNELS]; /* predictor: last frame in this block */
+  uint32_t raw_bytes;           /* bytes of frames accepted */
+  uint32_t out_bytes;           /* bytes of blocks sealed */
+  union dvz_block blk;          /* block being filled */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * dvz_init(): Starts an encoder
+ * @enc:       Encoder to initialise
+ * @fp:        File open with FA_WRITE on a sector boundary, or NULL
+ * @channels:  Samples per frame, 1..DVZ_MAX_CHANNELS
+ */
+FRESULT dvz_init(struct dvz_enc *enc, FIL *fp, uint8_t channels);
+
+/**
+ * dvz_put(): Encodes one frame
+ * @enc:    Encoder
+ * @frame:  @enc->channels samples
+ *
+ * A frame that does not fit the current block seals it with f_write() and
+ * starts the next block.
+ */
+FRESULT dvz_put(struct dvz_enc *enc, const int16_t *frame);
+
+/**
+ * dvz_flush(): Makes every encoded frame durable
+ * @enc:  Encoder
+ *
+ * The partial block is written and synced in place; the file pointer steps
+ * back over it so later frames complete the same block.
+ */
+FRESULT dvz_flush(struct dvz_enc *enc);
+
+/**
+ * dvz_decode_block(): Decodes one block
+ * @blk:         DVZ_BLOCK bytes
+ * @out:         Receives frames * channels samples
+ * @max_frames:  Room in @out, in frames
+ * @channels:    Set to the block's samples per frame
+ *
+ * Returns the number of frames decoded, or -1 for a torn, truncated or
+ * foreign block, or when the block holds more than @max_frames frames.
+ */
+int dvz_decode_block(const void *blk, int16_t *out, uint16_t max_frames, uint8_t *channels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+#include "logidx.h"
+#include <string.h>
+
+#define ENTRY_AT(n)   (sizeof(struct logidx_hdr) + (DWORD)(n) * sizeof(struct logidx_entry))
+
+
+FRESULT __attribute__((section(".upper.text"))) logidx_open(struct logidx *ix, FIL *fp, uint16_t stride)
+{
+  struct logidx_hdr hdr;
+  FRESULT res;
+  UINT n;
+
+  ix->fp = fp;
+  ix->countdown = 0;                              // First sector always gets an entry
+
+  if (f_size(fp) == 0) {
+    if (!stride)
+      return FR_INVALID_PARAMETER;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.magic = LOGIDX_MAGIC;
+    hdr.version = LOGIDX_VERSION;
+    hdr.stride = stride;
+    ix->stride = stride;
+    res = f_write(fp, &hdr, sizeof hdr, &n);
+    return (res == FR_OK && n != sizeof hdr) ? FR_DENIED : res;
+  }
+
+  res = f_lseek(fp, 0);
+  if (res == FR_OK)
+    res = f_read(fp, &hdr, sizeof hdr, &n);
+  if (res != FR_OK)
+    return res;
+  if (n != sizeof hdr || hdr.magic != LOGIDX_MAGIC || hdr.version != LOGIDX_VERSION || !hdr.stride)
+    return FR_NO_FILESYSTEM;
+  ix->stride = hdr.stride;
+
+  // Drop a torn trailing entry so appends stay entry aligned
+  return f_lseek(fp, ENTRY_AT((f_size(fp) - sizeof hdr) / sizeof(struct logidx_entry)));
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) logidx_note(struct logidx *ix, uint32_t ts, DWORD offset)
+{
+  struct logidx_entry e;
+  FRESULT res;
+  UINT n;
+
+  if (ix->countdown) {
+    ix->countdown--;
+    return FR_OK;
+  }
+  ix->countdown = ix->stride - 1;
+
+  e.ts = ts;
+  e.offset = offset;
+  res = f_write(ix->fp, &e, sizeof e, &n);
+  return (res == FR_OK && n != sizeof e) ? FR_DENIED : res;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) logidx_sync(struct logidx *ix)
+{
+  return f_sync(ix->fp);
+}
+
+
+static FRESULT __attribute__((section(".upper.text"))) read_entry(FIL *fp, DWORD i, struct logidx_entry *e)
+{
+  FRESULT res;
+  UINT n;
+
+  res = f_lseek(fp, ENTRY_AT(i));
+  if (res == FR_OK)
+    res = f_read(fp, e, sizeof *e, &n);
+  return (res == FR_OK && n != sizeof *e) ? FR_INT_ERR : res;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) logidx_lookup(FIL *fp, uint32_t ts, DWORD *offset)
+{
+  struct logidx_entry e;
+  FRESULT res;
+  DWORD lo = 0, hi, mid;
+
+  *offset = 0;
+  if (f_size(fp) < sizeof(struct logidx_hdr))
+    return FR_NO_FILESYSTEM;
+  hi = (f_size(fp) - sizeof(struct logidx_hdr)) / sizeof(struct logidx_entry);
+
+  // Find the first entry at or after @ts; the one before it starts earlier.
+  // Records sharing a timestamp may spill back over a sector boundary, hence
+  // "before" rather than "at or before".
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    res = read_entry(fp, mid, &e);
+    if (res != FR_OK)
+      return res;
+    if (e.ts < ts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo) {
+    res = read_entry(fp, lo - 1, &e);
+    if (res != FR_OK)
+      return res;
+    *offset = e.offset;
+  }
+  return FR_OK;
+}
+
+
+bool __attribute__((section(".upper.text"))) logidx_seek(struct reclog_reader *rd, FIL *idx, uint32_t ts, struct reclog_rec *rec)
+{
+  DWORD offset;
+
+  rd->err = logidx_lookup(idx, ts, &offset);
+  if (rd->err != FR_OK)
+    return false;
+  if (reclog_seek_sector(rd, offset / RECLOG_SECTOR) != FR_OK)
+    return false;
+
+  while (reclog_next(rd, rec)) {
+    if (rec->ts >= ts)
+      return true;
+  }
+  return false;
+}
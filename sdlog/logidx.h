@@ -0,0 +1,101 @@
+/*
+ * logidx.h: Sparse time index for record logs.
+ *
+ * The index is a separate file holding one {timestamp, byte offset} entry for
+ * every stride-th sector of a record log, written while the log is written.
+ * A time query binary-searches the index and seeks the log reader straight to
+ * the sector holding the first matching record, instead of reading the log
+ * from the start.
+ *
+ * Timestamps must not decrease along the log. Multi-byte fields are little
+ * endian, like the record log itself.
+ */
+#ifndef _LOGIDX_H
+#define _LOGIDX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../sdcard/ff.h"
+#include "reclog.h"
+
+#define LOGIDX_MAGIC        0x584C      /* "LX" */
+#define LOGIDX_VERSION      1
+
+struct logidx_hdr {
+  uint16_t magic;               /* LOGIDX_MAGIC */
+  uint16_t version;             /* LOGIDX_VERSION */
+  uint16_t stride;              /* log sectors per index entry */
+  uint16_t reserved[5];         /* 0, pads the header to 16 bytes */
+};
+
+struct logidx_entry {
+  uint32_t ts;                  /* ts_base of the indexed sector */
+  uint32_t offset;              /* byte offset of that sector in the log */
+};
+
+struct logidx {
+  FIL *fp;                      /* index file open with FA_WRITE */
+  uint16_t stride;              /* log sectors per entry */
+  uint16_t countdown;           /* sectors left until the next entry */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * logidx_open(): Starts writing an index
+ * @ix:      Writer to initialise
+ * @fp:      Index file open with FA_WRITE | FA_READ
+ * @stride:  Log sectors per entry, used only when the file is empty
+ *
+ * An empty file gets a new header. An existing index keeps its own stride
+ * and is appended to.
+ */
+FRESULT logidx_open(struct logidx *ix, FIL *fp, uint16_t stride);
+
+/**
+ * logidx_note(): Reports the start of a log sector
+ * @ix:      Writer
+ * @ts:      Timestamp of the first record in the sector
+ * @offset:  Byte offset of the sector in the log
+ *
+ * Called by reclog_append() for every new sector when reclog.idx is set.
+ * Only every stride-th call adds an entry.
+ */
+FRESULT logidx_note(struct logidx *ix, uint32_t ts, DWORD offset);
+
+/**
+ * logidx_sync(): Flushes the index file
+ * @ix:  Writer
+ */
+FRESULT logidx_sync(struct logidx *ix);
+
+/**
+ * logidx_lookup(): Finds where to start reading for a timestamp
+ * @fp:      Index file open with FA_READ
+ * @ts:      Timestamp wanted
+ * @offset:  Set to the log offset of the last indexed sector starting before
+ *           @ts, or 0 when there is none
+ *
+ * Binary search, so a query costs log2(entries) small reads of the index.
+ */
+FRESULT logidx_lookup(FIL *fp, uint32_t ts, DWORD *offset);
+
+/**
+ * logidx_seek(): Positions a log reader on the first record at or after a timestamp
+ * @rd:   Reader on the record log
+ * @idx:  Index file open with FA_READ
+ * @ts:   Timestamp wanted
+ * @rec:  Filled with the first matching record
+ *
+ * Returns false when no record matches (rd->err == FR_OK) or on error. The
+ * following reclog_next() calls continue after @rec.
+ */
+bool logidx_seek(struct reclog_reader *rd, FIL *idx, uint32_t ts, struct reclog_rec *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
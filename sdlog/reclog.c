@@ -0,0 +1,214 @@
+#include "reclog.h"
+#include "logidx.h"
+#include "../sdcard/diskio.h"
+#include <stddef.h>
+#include <string.h>
+
+
+// Nibble table: 32 bytes of FRAM instead of 512 for the byte table
+static const uint16_t crc_nibble[16] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+
+uint16_t __attribute__((section(".upper.text"))) reclog_crc16(uint16_t crc, const void *data, uint16_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+
+  while (len--) {
+    crc = (uint16_t)(crc << 4) ^ crc_nibble[(crc >> 12) ^ (*p >> 4)];
+    crc = (uint16_t)(crc << 4) ^ crc_nibble[(crc >> 12) ^ (*p++ & 0x0F)];
+  }
+  return crc;
+}
+
+
+// CRC of a sector image as if its crc field were zero
+static uint16_t __attribute__((section(".upper.text"))) sector_crc(const union reclog_sector *s)
+{
+  static const uint16_t zero = 0;
+  uint16_t crc;
+
+  crc = reclog_crc16(0xFFFF, s->b, offsetof(struct reclog_hdr, crc));
+  crc = reclog_crc16(crc, &zero, sizeof zero);
+  return reclog_crc16(crc, s->b + offsetof(struct reclog_hdr, seq),
+                      RECLOG_SECTOR - offsetof(struct reclog_hdr, seq));
+}
+
+
+bool __attribute__((section(".upper.text"))) reclog_sector_valid(const void *sect)
+{
+  const union reclog_sector *s = (const union reclog_sector *)sect;
+
+  if (s->h.magic != RECLOG_MAGIC || s->h.version != RECLOG_VERSION)
+    return false;
+  if (s->h.rec_size <= RECLOG_REC_HDR || !s->h.count)
+    return false;
+  if (s->h.count > (RECLOG_SECTOR - sizeof(struct reclog_hdr)) / s->h.rec_size)
+    return false;
+  return s->h.crc == sector_crc(s);
+}
+
+
+UINT __attribute__((section(".upper.text"))) reclog_sector_len(const BYTE *sect, void *arg)
+{
+  struct reclog_scan *sc = (struct reclog_scan *)arg;
+  const union reclog_sector *s = (const union reclog_sector *)sect;
+
+  if (!reclog_sector_valid(sect))
+    return 0;
+  if (sc->started && s->h.seq != sc->next_seq)
+    return 0;
+  sc->started = true;
+  sc->next_seq = s->h.seq + 1;
+  return RECLOG_SECTOR;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) reclog_open(struct reclog *lg, FIL *fp, uint8_t rec_size, uint32_t seq)
+{
+  if (rec_size <= RECLOG_REC_HDR || f_tell(fp) % RECLOG_SECTOR)
+    return FR_INVALID_PARAMETER;
+
+  lg->fp = fp;
+  lg->rec_size = rec_size;
+  lg->per_sector = (RECLOG_SECTOR - sizeof(struct reclog_hdr)) / rec_size;
+  lg->seq = seq;
+  lg->idx = 0;
+  lg->s.h.count = 0;
+  return FR_OK;
+}
+
+
+// Writes the sector image at the file pointer
+static FRESULT __attribute__((section(".upper.text"))) put_sector(struct reclog *lg)
+{
+  FRESULT res;
+  UINT bw;
+
+  lg->s.h.crc = sector_crc(&lg->s);
+  res = f_write(lg->fp, lg->s.b, RECLOG_SECTOR, &bw);
+  if (res == FR_OK && bw != RECLOG_SECTOR)
+    res = FR_DENIED;                              // Volume full
+  return res;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) reclog_append(struct reclog *lg, uint8_t type, uint32_t ts, const void *payload)
+{
+  FRESULT res;
+  uint16_t n = lg->s.h.count;
+
+  if (n && (n == lg->per_sector || ts - lg->s.h.ts_base > 0xFFFF)) {
+    res = put_sector(lg);                         // Seal the full sector
+    if (res != FR_OK)
+      return res;
+    lg->seq++;
+    n = 0;
+  }
+
+  if (!n) {
+    if (lg->idx) {
+      res = logidx_note(lg->idx, ts, f_tell(lg->fp));
+      if (res != FR_OK)
+        return res;
+    }
+    memset(lg->s.b, 0, RECLOG_SECTOR);
+    lg->s.h.magic = RECLOG_MAGIC;
+    lg->s.h.rec_size = lg->rec_size;
+    lg->s.h.version = RECLOG_VERSION;
+    lg->s.h.seq = lg->seq;
+    lg->s.h.ts_base = ts;
+  }
+
+  uint8_t *rec = lg->s.b + sizeof(struct reclog_hdr) + n * lg->rec_size;
+  struct reclog_rec_hdr rh;
+  rh.dt = (uint16_t)(ts - lg->s.h.ts_base);
+  rh.type = type;
+  rh.flags = 0;
+  memcpy(rec, &rh, RECLOG_REC_HDR);
+  memcpy(rec + RECLOG_REC_HDR, payload, lg->rec_size - RECLOG_REC_HDR);
+  lg->s.h.count = n + 1;
+
+  return FR_OK;
+}
+
+
+// Sectors are self-checking, so the data alone is enough: f_recover_size()
+// with reclog_sector_len() rebuilds the size the directory entry missed
+#if _USE_DATASYNC
+#define log_sync  f_datasync
+#else
+#define log_sync  f_sync
+#endif
+
+FRESULT __attribute__((section(".upper.text"))) reclog_sync(struct reclog *lg)
+{
+  FRESULT res;
+
+  if (lg->s.h.count) {
+    res = put_sector(lg);
+    if (res == FR_OK)
+      res = log_sync(lg->fp);
+    if (res != FR_OK)
+      return res;
+#if _USE_FCACHE
+    // The FRAM cache keeps the sector image until the card has it, so a
+    // torn rewrite cannot lose these records: complete the sector in place
+    return f_lseek(lg->fp, f_tell(lg->fp) - RECLOG_SECTOR);
+#else
+    // Rewriting the sector could tear it and take the synced records along,
+    // so leave it sealed and continue in the next one
+    lg->seq++;
+    lg->s.h.count = 0;
+    return FR_OK;
+#endif
+  }
+  return log_sync(lg->fp);
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) reclog_reader_init(struct reclog_reader *rd, FIL *fp)
+{
+  rd->fp = fp;
+  rd->skipped = 0;
+  return reclog_seek_sector(rd, 0);
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) reclog_seek_sector(struct reclog_reader *rd, DWORD sector)
+{
+  rd->loaded = false;
+  rd->err = f_lseek(rd->fp, sector * RECLOG_SECTOR);
+  return rd->err;
+}
+
+
+bool __attribute__((section(".upper.text"))) reclog_next(struct reclog_reader *rd, struct reclog_rec *rec)
+{
+  UINT br;
+
+  while (!rd->loaded || rd->idx >= rd->s.h.count) {
+    rd->loaded = false;
+    rd->err = f_read(rd->fp, rd->s.b, RECLOG_SECTOR, &br);
+    if (rd->err != FR_OK || br < RECLOG_SECTOR)
+      return false;
+    if (!reclog_sector_valid(rd->s.b)) {
+      rd->skipped++;
+      continue;
+    }
+    rd->loaded = true;
+    rd->idx = 0;
+  }
+
+  const uint8_t *p = rd->s.b + sizeof(struct reclog_hdr) + rd->idx++ * rd->s.h.rec_size;
+  struct reclog_rec_hdr rh;
+  memcpy(&rh, p, RECLOG_REC_HDR);
+  rec->seq = rd->s.h.seq;
+  rec->ts = rd->s.h.ts_base + rh.dt;
+  rec->type = rh.type;
+  rec->len = rd->s.h.rec_size - RECLOG_REC_HDR;
+  rec->data = p + RECLOG_REC_HDR;
+  return true;
+}
@@ -0,0 +1,175 @@
+/*
+ * reclog.h: Fixed-size binary record log with sector-aligned framing.
+ *
+ * Every 512 byte sector of a record log stands alone: a 16 byte header
+ * followed by as many fixed-size records as fit, with the tail padded with
+ * zeros. No record straddles two sectors, so a reader can f_lseek() to any
+ * multiple of 512 and start decoding, and a sector torn by power loss fails
+ * its CRC and is skipped without touching its neighbours.
+ *
+ * Multi-byte fields are stored little endian (native on the MSP430).
+ */
+#ifndef _RECLOG_H
+#define _RECLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../sdcard/ff.h"
+
+#define RECLOG_SECTOR       512
+#define RECLOG_MAGIC        0x4C52      /* "RL" */
+#define RECLOG_VERSION      1
+#define RECLOG_REC_HDR      4           /* bytes of each record taken by struct reclog_rec_hdr */
+
+struct reclog_hdr {
+  uint16_t magic;               /* RECLOG_MAGIC */
+  uint8_t rec_size;             /* bytes per record, record header included */
+  uint8_t version;              /* RECLOG_VERSION */
+  uint16_t count;               /* records in this sector */
+  uint16_t crc;                 /* CRC-16/CCITT of the sector with this field zero */
+  uint32_t seq;                 /* sector sequence number, +1 per sealed sector */
+  uint32_t ts_base;             /* timestamp of the first record */
+};
+
+struct reclog_rec_hdr {
+  uint16_t dt;                  /* timestamp - ts_base */
+  uint8_t type;                 /* application record type */
+  uint8_t flags;                /* reserved, 0 */
+};
+
+union reclog_sector {
+  struct reclog_hdr h;
+  uint8_t b[RECLOG_SECTOR];
+};
+
+struct logidx;
+
+struct reclog {
+  FIL *fp;                      /* file open with FA_WRITE */
+  uint8_t rec_size;             /* bytes per record, record header included */
+  uint16_t per_sector;          /* records that fit after the sector header */
+  uint32_t seq;                 /* sequence number of the sector being filled */
+  struct logidx *idx;           /* optional time index (logidx.h), set after reclog_open() */
+  union reclog_sector s;        /* sector being filled */
+};
+
+struct reclog_rec {
+  uint32_t seq;                 /* sector the record came from */
+  uint32_t ts;                  /* full timestamp */
+  uint8_t type;                 /* application record type */
+  uint8_t len;                  /* payload bytes */
+  const uint8_t *data;          /* payload, valid until the next reclog_next() */
+};
+
+struct reclog_reader {
+  FIL *fp;                      /* file open with FA_READ */
+  union reclog_sector s;        /* current sector */
+  uint16_t idx;                 /* next record in s */
+  bool loaded;                  /* s holds a valid sector */
+  uint32_t skipped;             /* sectors rejected as torn or foreign */
+  FRESULT err;                  /* why reclog_next() last returned false */
+};
+
+/* Length marker state for f_recover_size() */
+struct reclog_scan {
+  bool started;                 /* next_seq is known */
+  uint32_t next_seq;            /* sequence number the next sector must carry */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * reclog_crc16(): CRC-16/CCITT (poly 0x1021) over a block
+ * @crc:   Initial value, 0xFFFF to start a new CRC
+ * @data:  Block
+ * @len:   Block length
+ */
+uint16_t reclog_crc16(uint16_t crc, const void *data, uint16_t len);
+
+/**
+ * reclog_sector_valid(): Checks the header, record count and CRC of a sector
+ * @sect:  512 byte sector image
+ *
+ * Returns true for a complete record log sector.
+ */
+bool reclog_sector_valid(const void *sect);
+
+/**
+ * reclog_sector_len(): Length marker callback for f_recover_size()
+ * @sect:  Sector past the recorded end of the log
+ * @arg:   struct reclog_scan, zeroed or seeded with the sequence number
+ *         following the last recorded sector
+ *
+ * Returns 512 for a valid sector continuing the sequence and 0 otherwise, so
+ * stale sectors left in reused clusters end the scan.
+ */
+UINT reclog_sector_len(const BYTE *sect, void *arg);
+
+/**
+ * reclog_open(): Starts a record log writer
+ * @lg:        Writer to initialise
+ * @fp:        File open with FA_WRITE, positioned on a sector boundary
+ * @rec_size:  Bytes per record including the RECLOG_REC_HDR byte header
+ * @seq:       Sequence number for the first sector written
+ */
+FRESULT reclog_open(struct reclog *lg, FIL *fp, uint8_t rec_size, uint32_t seq);
+
+/**
+ * reclog_append(): Adds a record
+ * @lg:       Writer
+ * @type:     Application record type
+ * @ts:       Timestamp in application ticks
+ * @payload:  rec_size - RECLOG_REC_HDR bytes
+ *
+ * The sector is sealed and written once it is full, or when @ts is more than
+ * 65535 ticks past the sector's base timestamp.
+ */
+FRESULT reclog_append(struct reclog *lg, uint8_t type, uint32_t ts, const void *payload);
+
+/**
+ * reclog_sync(): Makes every appended record durable
+ * @lg:  Writer
+ *
+ * A partly filled sector is written and synced. With _USE_FCACHE (diskio.h)
+ * the file pointer is stepped back over it so later records complete the same
+ * sector: the FRAM cache holds each sector image until the card has accepted
+ * it, so a power cut during the rewrite cannot lose the synced records.
+ * Without the cache the sector is left sealed, short, and logging continues
+ * in the next sector, trading card space for the same guarantee. With
+ * _USE_DATASYNC this is f_datasync(): after power loss, reopen the log and
+ * run f_recover_size() with reclog_sector_len() before appending.
+ */
+FRESULT reclog_sync(struct reclog *lg);
+
+/**
+ * reclog_reader_init(): Starts reading a record log from its first sector
+ * @rd:  Reader to initialise
+ * @fp:  File open with FA_READ
+ */
+FRESULT reclog_reader_init(struct reclog_reader *rd, FIL *fp);
+
+/**
+ * reclog_seek_sector(): Moves the reader to a sector
+ * @rd:      Reader
+ * @sector:  Sector index within the file
+ */
+FRESULT reclog_seek_sector(struct reclog_reader *rd, DWORD sector);
+
+/**
+ * reclog_next(): Returns the next record
+ * @rd:   Reader
+ * @rec:  Filled with the record
+ *
+ * Sectors failing reclog_sector_valid() are counted in rd->skipped and
+ * stepped over. Returns false at the end of the file (rd->err == FR_OK) or on
+ * a read error (rd->err holds it).
+ */
+bool reclog_next(struct reclog_reader *rd, struct reclog_rec *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#include "ringbuf.h"
+#include <string.h>
+
+
+bool __attribute__((section(".upper.text"))) rb_init(struct ringbuf *rb, uint8_t *mem, uint16_t size)
+{
+  if (!size || size > 0x8000 || (size & (size - 1)))
+    return false;
+
+  rb->mem = mem;
+  rb->mask = size - 1;
+  rb->head = 0;
+  rb->tail = 0;
+  rb->high_water = 0;
+  rb->drops = 0;
+  rb->drop_bytes = 0;
+  return true;
+}
+
+
+bool __attribute__((section(".upper.text"))) rb_put(struct ringbuf *rb, const void *data, uint16_t len)
+{
+  uint16_t head = rb->head;                       // Only this side writes head
+  uint16_t used = (uint16_t)(head - RB_LOAD_ACQ(rb->tail));
+  uint16_t size = rb->mask + 1;
+
+  if (len > (uint16_t)(size - used)) {
+    if (rb->drops != 0xFFFF)
+      rb->drops++;
+    uint16_t lost = (uint16_t)(rb->drop_bytes + len);
+    rb->drop_bytes = lost < len ? 0xFFFF : lost;
+    return false;
+  }
+
+  // Copy in at most two pieces, then publish with the head update
+  uint16_t at = head & rb->mask;
+  uint16_t first = size - at;
+  if (first > len)
+    first = len;
+  memcpy(rb->mem + at, data, first);
+  memcpy(rb->mem, (const uint8_t *)data + first, len - first);
+  RB_STORE_REL(rb->head, (uint16_t)(head + len));
+
+  used += len;
+  if (used > rb->high_water)
+    rb->high_water = used;
+  return true;
+}
+
+
+uint16_t __attribute__((section(".upper.text"))) rb_used(const struct ringbuf *rb)
+{
+  return (uint16_t)(RB_LOAD_ACQ(rb->head) - rb->tail);
+}
+
+
+uint16_t __attribute__((section(".upper.text"))) rb_peek(const struct ringbuf *rb, const uint8_t **p)
+{
+  uint16_t used = rb_used(rb);
+  uint16_t at = rb->tail & rb->mask;
+  uint16_t to_end = (uint16_t)(rb->mask + 1 - at);
+
+  *p = rb->mem + at;
+  return used < to_end ? used : to_end;
+}
+
+
+void __attribute__((section(".upper.text"))) rb_consume(struct ringbuf *rb, uint16_t n)
+{
+  RB_STORE_REL(rb->tail, (uint16_t)(rb->tail + n));
+}
@@ -0,0 +1,89 @@
+/*
+ * ringbuf.h: Single-producer/single-consumer lock-free byte ring buffer.
+ *
+ * The producer (an ISR on the MSP430, a thread on a host) only ever writes
+ * head and the producer statistics; the consumer (the main loop) only ever
+ * writes tail. Both indices are free-running 16 bit counters, so a 16 bit
+ * load or store is all either side needs to see a consistent value.
+ */
+#ifndef _RINGBUF_H
+#define _RINGBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Orders buffer accesses against the index update that publishes them. The
+ * MSP430 is single core and in order, so stopping the compiler is enough. */
+#ifdef __MSP430__
+#define RB_LOAD_ACQ(x)      ({ uint16_t _v = (x); __asm__ __volatile__("" ::: "memory"); _v; })
+#define RB_STORE_REL(x, v)  do { __asm__ __volatile__("" ::: "memory"); (x) = (v); } while (0)
+#else
+#define RB_LOAD_ACQ(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RB_STORE_REL(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#endif
+
+struct ringbuf {
+  uint8_t *mem;                 /* storage, size bytes (SRAM or FRAM) */
+  uint16_t mask;                /* size - 1, size a power of two <= 32768 */
+  volatile uint16_t head;       /* producer: next byte to write */
+  volatile uint16_t tail;       /* consumer: next byte to read */
+
+  /* Producer-side statistics, written only by rb_put() */
+  volatile uint16_t high_water; /* most bytes ever waiting */
+  volatile uint16_t drops;      /* records rejected for lack of space (saturates) */
+  volatile uint16_t drop_bytes; /* bytes in those records (saturates) */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * rb_init(): Sets up an empty ring buffer over caller provided storage
+ * @rb:    Ring buffer to initialise
+ * @mem:   Backing storage
+ * @size:  Bytes of storage, a power of two no larger than 32768
+ *
+ * Returns false when @size is not usable.
+ */
+bool rb_init(struct ringbuf *rb, uint8_t *mem, uint16_t size);
+
+/**
+ * rb_put(): Appends one record (producer side, ISR safe)
+ * @rb:    Ring buffer
+ * @data:  Record bytes
+ * @len:   Record length
+ *
+ * Records are never split: when the whole record does not fit it is dropped,
+ * counted in the drop statistics and false is returned.
+ */
+bool rb_put(struct ringbuf *rb, const void *data, uint16_t len);
+
+/**
+ * rb_used(): Returns the number of bytes waiting for the consumer
+ * @rb:    Ring buffer
+ */
+uint16_t rb_used(const struct ringbuf *rb);
+
+/**
+ * rb_peek(): Finds the readable bytes that are contiguous in memory (consumer side)
+ * @rb:    Ring buffer
+ * @p:     Set to the first readable byte
+ *
+ * Returns the contiguous byte count, which stops short of rb_used() when the
+ * data wraps past the end of the storage.
+ */
+uint16_t rb_peek(const struct ringbuf *rb, const uint8_t **p);
+
+/**
+ * rb_consume(): Releases bytes returned by rb_peek() back to the producer
+ * @rb:    Ring buffer
+ * @n:     Bytes consumed
+ */
+void rb_consume(struct ringbuf *rb, uint16_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,184 @@
+#include "rotate.h"
+#include <string.h>
+
+#define NAME_DIGITS   7
+#define NAME_LEN      12                          // "L0000000.LOG"
+
+
+// Builds dir/<kind><n>.LOG
+static void __attribute__((section(".upper.text"))) make_path(const struct rotate *rt, TCHAR *path, char kind, uint32_t n)
+{
+  size_t len = strlen(rt->dir);
+  TCHAR *p = path;
+
+  memcpy(p, rt->dir, len);
+  p += len;
+  if (len)
+    *p++ = '/';
+  *p++ = kind;
+  for (int i = NAME_DIGITS - 1; i >= 0; i--, n /= 10)
+    p[i] = (TCHAR)('0' + n % 10);
+  memcpy(p + NAME_DIGITS, ".LOG", 5);
+}
+
+
+// Returns the number in a pool file name of the given kind, 0 if it is not one
+static uint32_t __attribute__((section(".upper.text"))) name_number(const TCHAR *name, char kind)
+{
+  uint32_t n = 0;
+
+  if (name[0] != kind || strcmp(name + 1 + NAME_DIGITS, ".LOG"))
+    return 0;
+  for (int i = 1; i <= NAME_DIGITS; i++) {
+    if (name[i] < '0' || name[i] > '9')
+      return 0;
+    n = n * 10 + (uint32_t)(name[i] - '0');
+  }
+  return n;
+}
+
+
+// Rebuilds the pool state from the directory
+static FRESULT __attribute__((section(".upper.text"))) scan(struct rotate *rt, uint16_t *logs, uint32_t *spare_max)
+{
+  FILINFO fno;
+  DIR dir;
+  FRESULT res;
+  uint32_t n;
+
+  rt->seq = rt->oldest = 0;
+  rt->spare_next = rt->spares = 0;
+  *logs = 0;
+  *spare_max = 0;
+
+  res = f_opendir(&dir, rt->dir);
+  while (res == FR_OK) {
+    res = f_readdir(&dir, &fno);
+    if (res != FR_OK || !fno.fname[0])
+      break;
+    if ((n = name_number(fno.fname, 'L')) != 0) {
+      (*logs)++;
+      if (n > rt->seq)
+        rt->seq = n;
+      if (!rt->oldest || n < rt->oldest)
+        rt->oldest = n;
+    } else if ((n = name_number(fno.fname, 'S')) != 0) {
+      rt->spares++;
+      if (!rt->spare_next || n < rt->spare_next)
+        rt->spare_next = n;
+      if (n > *spare_max)
+        *spare_max = n;
+    }
+  }
+  f_closedir(&dir);
+  return res;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) rotate_init(struct rotate *rt, FIL *fp, const TCHAR *dir, uint16_t nfiles, DWORD file_size)
+{
+  FRESULT res;
+  uint16_t logs;
+  uint32_t spare_max;
+
+  if (!nfiles || !file_size || strlen(dir) + 1 + NAME_LEN >= ROTATE_PATH_MAX)
+    return FR_INVALID_PARAMETER;
+
+  rt->fp = fp;
+  rt->open = false;
+  rt->dir = dir;
+  rt->nfiles = nfiles;
+  rt->file_size = file_size;
+
+  if (dir[0]) {
+    res = f_mkdir(dir);
+    if (res != FR_OK && res != FR_EXIST)
+      return res;
+  }
+  res = scan(rt, &logs, &spare_max);
+  if (res != FR_OK)
+    return res;
+
+  // Top the pool up with spares, each one contiguous run of clusters
+  while (logs + rt->spares < nfiles) {
+    make_path(rt, rt->to, 'S', ++spare_max);
+    res = f_open(fp, rt->to, FA_CREATE_NEW | FA_WRITE);
+    if (res != FR_OK)
+      return res;
+    res = f_expand(fp, file_size);
+    if (res == FR_OK)
+      res = f_close(fp);
+    else
+      f_close(fp);
+    if (res != FR_OK)
+      return res;
+    if (!rt->spares++)
+      rt->spare_next = spare_max;
+  }
+
+  return rotate_next(rt);
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) rotate_next(struct rotate *rt)
+{
+  FRESULT res;
+  uint16_t logs;
+  uint32_t spare_max;
+  bool spare;
+
+  res = rotate_close(rt);
+  if (res != FR_OK)
+    return res;
+
+  for (int tries = 0; ; tries++) {
+    spare = rt->spares != 0;
+    if (spare)
+      make_path(rt, rt->from, 'S', rt->spare_next);
+    else if (rt->oldest)
+      make_path(rt, rt->from, 'L', rt->oldest);
+    else
+      return FR_NO_FILE;                          // Empty pool
+    make_path(rt, rt->to, 'L', rt->seq + 1);
+
+    res = f_recycle(rt->from, rt->to);
+    if (res != FR_NO_FILE || tries)
+      break;
+    res = scan(rt, &logs, &spare_max);            // Pool changed behind our back
+    if (res != FR_OK)
+      return res;
+  }
+  if (res != FR_OK)
+    return res;
+
+  if (spare) {
+    rt->spares--;
+    rt->spare_next++;
+  } else {
+    rt->oldest++;
+  }
+  if (!rt->oldest)
+    rt->oldest = rt->seq + 1;
+  rt->seq++;
+
+  res = f_open(rt->fp, rt->to, FA_WRITE | FA_READ);
+  rt->open = res == FR_OK;
+  return res;
+}
+
+
+DWORD __attribute__((section(".upper.text"))) rotate_room(const struct rotate *rt)
+{
+  if (!rt->open)
+    return 0;
+  return f_size(rt->fp) - f_tell(rt->fp);
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) rotate_close(struct rotate *rt)
+{
+  if (!rt->open)
+    return FR_OK;
+  rt->open = false;
+  return f_close(rt->fp);
+}
@@ -0,0 +1,84 @@
+/*
+ * rotate.h: Log rotation over a pool of preallocated, contiguous files.
+ *
+ * The pool is a directory of files created once with f_expand(), so each
+ * is one run of clusters. Logs are named L0000001.LOG, L0000002.LOG ... and
+ * files not used yet S0000001.LOG ... Rotating renames the next spare, or
+ * else the oldest log, to the next log number with f_recycle(): the entry
+ * is rewritten in place and the cluster chain is kept, so a rotation never
+ * touches the FAT and every log stays physically contiguous.
+ *
+ * A recycled file keeps its size and the old log's data until overwritten.
+ * Writers must use self-framing records whose sequence numbers carry on
+ * across logs (reclog_open() with the last log's next sequence number), so
+ * readers stop where the new data ends.
+ */
+#ifndef _ROTATE_H
+#define _ROTATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../sdcard/ff.h"
+
+#define ROTATE_PATH_MAX     32          /* directory + "/L0000000.LOG" + NUL */
+
+struct rotate {
+  FIL *fp;                      /* current log, open with FA_WRITE | FA_READ */
+  bool open;                    /* fp holds the current log */
+  const TCHAR *dir;             /* pool directory, "" for the root */
+  uint16_t nfiles;              /* files in the pool */
+  DWORD file_size;              /* bytes preallocated per file */
+  uint32_t seq;                 /* number of the current log, 0: none yet */
+  uint32_t oldest;              /* number of the oldest log, 0: none */
+  uint32_t spare_next;          /* number of the next spare to use */
+  uint16_t spares;              /* spares left */
+  TCHAR from[ROTATE_PATH_MAX];  /* name being recycled */
+  TCHAR to[ROTATE_PATH_MAX];    /* its new name */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * rotate_init(): Opens a log pool and starts a new log in it
+ * @rt:         Manager to initialise
+ * @fp:         File object used for the current log
+ * @dir:        Pool directory, created if missing; at most 18 characters
+ * @nfiles:     Files in the pool
+ * @file_size:  Bytes per file, used when the pool is topped up
+ *
+ * Missing pool files are created and preallocated as spares, so the first
+ * call on a new card allocates nfiles * file_size bytes. Every call starts a
+ * new log; logs are not appended to across resets.
+ */
+FRESULT rotate_init(struct rotate *rt, FIL *fp, const TCHAR *dir, uint16_t nfiles, DWORD file_size);
+
+/**
+ * rotate_next(): Closes the current log and starts the next one
+ * @rt:  Manager
+ *
+ * Costs one directory entry rewrite and an f_open(); the FAT is not touched.
+ * The new log is open at offset 0.
+ */
+FRESULT rotate_next(struct rotate *rt);
+
+/**
+ * rotate_room(): Bytes left in the current log
+ * @rt:  Manager
+ *
+ * Writing past this would grow the file with new clusters; rotate instead.
+ */
+DWORD rotate_room(const struct rotate *rt);
+
+/**
+ * rotate_close(): Closes the current log
+ * @rt:  Manager
+ */
+FRESULT rotate_close(struct rotate *rt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
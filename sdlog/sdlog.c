@@ -0,0 +1,102 @@
+#include "sdlog.h"
+
+#define SECTOR_SIZE   512
+
+
+FRESULT __attribute__((section(".upper.text"))) sdlog_init(struct sdlog *lg, struct ringbuf *rb, FIL *fp, uint16_t sync_every)
+{
+  if ((uint32_t)rb->mask + 1 < SECTOR_SIZE)
+    return FR_INVALID_PARAMETER;
+
+  lg->rb = rb;
+  lg->fp = fp;
+  lg->sync_every = sync_every;
+  lg->since_sync = 0;
+  lg->bytes = 0;
+  lg->max_batch = 0;
+  lg->drains = 0;
+  return FR_OK;
+}
+
+
+// Moves ring data into the file. Without @all only data that reaches a file
+// sector boundary is written; with @all the trailing partial sector goes too.
+static FRESULT __attribute__((section(".upper.text"))) drain(struct sdlog *lg, bool all)
+{
+  FRESULT res;
+  const uint8_t *p;
+  uint16_t used, gap, want, span;
+  uint32_t batch = 0;
+  UINT bw;
+
+  for (;;) {
+    used = rb_used(lg->rb);
+    gap = SECTOR_SIZE - (uint16_t)(f_tell(lg->fp) % SECTOR_SIZE);  // Up to the next sector boundary
+    if (used >= gap)
+      want = gap + ((used - gap) & ~(SECTOR_SIZE - 1));
+    else if (all && used)
+      want = used;
+    else
+      break;
+
+    span = rb_peek(lg->rb, &p);                   // Wrapped data takes two passes
+    if (want > span)
+      want = span;
+
+    res = f_write(lg->fp, p, want, &bw);
+    rb_consume(lg->rb, (uint16_t)bw);
+    lg->bytes += bw;
+    batch += bw;
+    if (res != FR_OK)
+      return res;
+    if (bw != want)
+      return FR_DENIED;                           // Volume full
+
+    if (lg->sync_every && f_tell(lg->fp) % SECTOR_SIZE == 0) {
+      lg->since_sync += (want + SECTOR_SIZE - 1) / SECTOR_SIZE;
+      if (lg->since_sync >= lg->sync_every) {
+        lg->since_sync = 0;
+        res = f_sync(lg->fp);
+        if (res != FR_OK)
+          return res;
+      }
+    }
+  }
+
+  if (batch) {
+    lg->drains++;
+    if (batch > lg->max_batch)
+      lg->max_batch = batch > 0xFFFF ? 0xFFFF : (uint16_t)batch;
+  }
+  return FR_OK;
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) sdlog_drain(struct sdlog *lg)
+{
+  return drain(lg, false);
+}
+
+
+FRESULT __attribute__((section(".upper.text"))) sdlog_flush(struct sdlog *lg)
+{
+  FRESULT res = drain(lg, true);
+
+  if (res != FR_OK)
+    return res;
+  lg->since_sync = 0;
+  return f_sync(lg->fp);
+}
+
+
+void __attribute__((section(".upper.text"))) sdlog_get_stats(const struct sdlog *lg, struct sdlog_stats *st)
+{
+  uint32_t size = (uint32_t)lg->rb->mask + 1;
+
+  st->high_water = lg->rb->high_water;
+  st->high_water_pct = (uint8_t)((uint32_t)st->high_water * 100 / size);
+  st->drops = lg->rb->drops;
+  st->drop_bytes = lg->rb->drop_bytes;
+  st->sectors = lg->bytes / SECTOR_SIZE;
+  st->max_batch = lg->max_batch;
+}
@@ -0,0 +1,85 @@
+/*
+ * sdlog.h: Logging pipeline from interrupt context to an open FatFs file.
+ *
+ * ISRs push records into a struct ringbuf with rb_put(), which never blocks.
+ * The main loop calls sdlog_drain(), which hands whole sectors to f_write()
+ * straight out of the ring memory, so FatFs can write them to the card
+ * without going through its sector window.
+ */
+#ifndef _SDLOG_H
+#define _SDLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ringbuf.h"
+#include "../sdcard/ff.h"
+
+/* Ring bytes needed to log @rate_hz records of @rec_bytes each without drops
+ * when the card stalls for up to @stall_ms: the bytes arriving during the
+ * stall plus the sector being written when it starts. Round the result up to
+ * a power of two for rb_init(). */
+#define SDLOG_RING_BYTES(rate_hz, rec_bytes, stall_ms) \
+  ((uint32_t)(rate_hz) * (rec_bytes) * (stall_ms) / 1000 + 512)
+
+struct sdlog {
+  struct ringbuf *rb;           /* ring filled by the producer */
+  FIL *fp;                      /* file open for writing */
+  uint16_t sync_every;          /* f_sync() after this many sectors, 0: never */
+  uint16_t since_sync;          /* sectors written since the last f_sync() */
+  uint32_t bytes;               /* bytes handed to f_write() */
+  uint16_t max_batch;           /* most bytes written by one sdlog_drain() */
+  uint16_t drains;              /* sdlog_drain() calls that wrote something */
+};
+
+struct sdlog_stats {
+  uint16_t high_water;          /* most bytes ever waiting in the ring */
+  uint8_t high_water_pct;       /* the same as a percentage of the ring */
+  uint16_t drops;               /* records lost to a full ring */
+  uint16_t drop_bytes;          /* bytes in those records */
+  uint32_t sectors;             /* sectors handed to f_write() */
+  uint16_t max_batch;           /* largest single drain in bytes */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * sdlog_init(): Binds a ring buffer to an open file
+ * @lg:          Logger to initialise
+ * @rb:          Initialised ring buffer of at least 512 bytes
+ * @fp:          File open with FA_WRITE, positioned where logging starts
+ * @sync_every:  Sectors between f_sync() calls, 0 to leave syncing to the caller
+ *
+ * Returns FR_INVALID_PARAMETER when the ring is smaller than a sector.
+ */
+FRESULT sdlog_init(struct sdlog *lg, struct ringbuf *rb, FIL *fp, uint16_t sync_every);
+
+/**
+ * sdlog_drain(): Writes every whole sector waiting in the ring
+ * @lg:  Logger
+ *
+ * Writes are cut at file sector boundaries, so a partial sector stays in the
+ * ring until the producer completes it. Call from the main loop as often as
+ * the card allows; it returns at once when less than a sector is waiting.
+ */
+FRESULT sdlog_drain(struct sdlog *lg);
+
+/**
+ * sdlog_flush(): Writes everything waiting in the ring, partial sector included, then syncs
+ * @lg:  Logger
+ */
+FRESULT sdlog_flush(struct sdlog *lg);
+
+/**
+ * sdlog_get_stats(): Collects overflow and backpressure statistics
+ * @lg:   Logger
+ * @st:   Filled with the current figures
+ */
+void sdlog_get_stats(const struct sdlog *lg, struct sdlog_stats *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif